@@ -12,9 +12,10 @@ pushd $PSScriptRoot
 try {
     if(test-path build) { rm -r -fo build }
     md build | cd
-    cmake -G "Visual Studio 15 Win64" -DWITH_BOOST=OFF -DSOCI_EMPTY=OFF -DWITH_ORACLE=OFF -DWITH_ODBC=ON -DWITH_MYSQL=OFF -DWITH_POSTGRESQL=OFF -DWITH_FIREBIRD=OFF -DWITH_DB2=OFF -DSOCI_CXX_C11=ON -DSOCI_STATIC=ON -DSOCI_SHARED=OFF -DSOCI_TESTS=OFF ../src
+    cmake -G "Visual Studio 15 Win64" -DWITH_BOOST=OFF -DSOCI_EMPTY=OFF -DWITH_ORACLE=OFF -DWITH_ODBC=ON -DWITH_SQLITE3=ON -DWITH_MYSQL=OFF -DWITH_POSTGRESQL=OFF -DWITH_FIREBIRD=OFF -DWITH_DB2=OFF -DSOCI_CXX_C11=ON -DSOCI_STATIC=ON -DSOCI_SHARED=OFF -DSOCI_TESTS=OFF ../src
     SetReleaseModeToStaticLinkRuntimeLibrary src/core/soci_core_static.vcxproj
     SetReleaseModeToStaticLinkRuntimeLibrary src/backends/odbc/soci_odbc_static.vcxproj
+    SetReleaseModeToStaticLinkRuntimeLibrary src/backends/sqlite3/soci_sqlite3_static.vcxproj
     cmake --build . --config Debug
     cmake --build . --config Release
 }
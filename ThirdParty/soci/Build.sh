@@ -1,6 +1,10 @@
 #!/bin/bash
+set -e
+cd "$(dirname "$0")"
 rm -rf linuxbuild
 mkdir linuxbuild
 cd linuxbuild
-cmake -DCMAKE_BUILD_TYPE=MinSizeRel -DWITH_BOOST=OFF -DSOCI_EMPTY=OFF -DWITH_ORACLE=OFF -DWITH_ODBC=ON -DWITH_MYSQL=OFF -DWITH_POSTGRESQL=OFF -DWITH_FIREBIRD=OFF -DWITH_DB2=OFF -DSOCI_CXX_C11=ON -DSOCI_STATIC=ON -DSOCI_SHARED=OFF -DSOCI_TESTS=OFF ../src
+cmake -DCMAKE_BUILD_TYPE=MinSizeRel -DWITH_BOOST=OFF -DSOCI_EMPTY=OFF -DWITH_ORACLE=OFF -DWITH_ODBC=ON -DWITH_SQLITE3=ON -DWITH_MYSQL=OFF -DWITH_POSTGRESQL=OFF -DWITH_FIREBIRD=OFF -DWITH_DB2=OFF -DSOCI_CXX_C11=ON -DSOCI_STATIC=ON -DSOCI_SHARED=OFF -DSOCI_TESTS=OFF -DCMAKE_CXX_FLAGS="-Wno-error=deprecated-declarations" ../src
 cmake --build .
+# SOCI leaves out backends whose client library it cannot find, without failing.
+test -f lib/libsoci_sqlite3.a || { echo "The SOCI sqlite3 backend was not built; is libsqlite3-dev installed?" >&2; exit 1; }
@@ -0,0 +1,22 @@
+$ErrorActionPreference = 'Stop'
+
+# Downloads the SQLite amalgamation and builds it as a static library, in the include and lib folders that
+# SQLITE_ROOT points to. The library does not name a runtime library, so it links with any configuration.
+$version = '3300100'
+$vcvars = 'C:\Program Files (x86)\Microsoft Visual Studio\2017\BuildTools\VC\Auxiliary\Build\vcvars64.bat'
+
+pushd $PSScriptRoot
+try {
+    if(test-path build) { rm -r -fo build }
+    md build | cd
+    [Net.ServicePointManager]::SecurityProtocol = [Net.SecurityProtocolType]::Tls12
+    Invoke-WebRequest "https://www.sqlite.org/2019/sqlite-amalgamation-$version.zip" -OutFile sqlite.zip
+    Expand-Archive sqlite.zip -DestinationPath .
+    md include, lib | Out-Null
+    cp "sqlite-amalgamation-$version/sqlite3.h" include
+    cmd /c "call `"$vcvars`" && cl /nologo /c /O2 /Zl sqlite-amalgamation-$version/sqlite3.c && lib /nologo sqlite3.obj /out:lib/sqlite3.lib"
+    if($LASTEXITCODE -ne 0) { throw 'SQLite build failed' }
+}
+finally {
+    popd
+}
@@ -1 +1,4 @@
+set SQLITE_ROOT=%~dp0ThirdParty\sqlite\build
+powershell -NoProfile -ExecutionPolicy Bypass -File ThirdParty\sqlite\Build.ps1 || exit /b 1
+powershell -NoProfile -ExecutionPolicy Bypass -File ThirdParty\soci\Build.ps1 || exit /b 1
 "C:\Program Files (x86)\Microsoft Visual Studio\2017\BuildTools\MSBuild\15.0\Bin\msbuild.exe" sqlgrep.sln /p:Configuration=Release
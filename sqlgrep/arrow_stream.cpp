@@ -0,0 +1,399 @@
+#include "pch.h"
+#include "arrow_stream.h"
+
+using namespace std;
+
+// A minimal FlatBuffers encoder for Arrow IPC metadata. Objects are written front to back: each table
+// is followed by the objects it refers to, and its offsets are filled in once their positions are known.
+class flatbuffer_writer
+{
+public:
+    using object = function<size_t(flatbuffer_writer &)>;
+
+    struct field
+    {
+        int id;
+        string scalar;
+        object reference;
+    };
+
+    template <typename T>
+    static field scalar(int const id, T const value)
+    {
+        string bytes(sizeof(T), '\0');
+        memcpy(bytes.data(), &value, sizeof(T));
+        return { id, move(bytes), {} };
+    }
+
+    static field reference(int const id, object write)
+    {
+        return { id, {}, move(write) };
+    }
+
+    string finish(object const & root)
+    {
+        buffer_.assign(sizeof(uint32_t), '\0');
+        patch(0, root(*this));
+        pad(8);
+        return move(buffer_);
+    }
+
+    size_t table(vector<field> const & fields)
+    {
+        auto const get_size = [](field const & f) { return f.reference ? sizeof(uint32_t) : f.scalar.size(); };
+        int largest_id = -1;
+        size_t alignment = sizeof(int32_t);
+        for (auto const & f : fields)
+        {
+            largest_id = max(largest_id, f.id);
+            alignment = max(alignment, get_size(f));
+        }
+
+        // Larger fields go first to keep them aligned without padding.
+        vector<size_t> order(fields.size());
+        iota(begin(order), end(order), 0);
+        stable_sort(begin(order), end(order), [&](size_t a, size_t b) { return get_size(fields[a]) > get_size(fields[b]); });
+        vector<uint16_t> slots(largest_id + 1, 0);
+        vector<size_t> positions(fields.size());
+        size_t table_size = sizeof(int32_t);
+        for (auto const i : order)
+        {
+            auto const size = get_size(fields[i]);
+            table_size = (table_size + size - 1) / size * size;
+            positions[i] = table_size;
+            slots[fields[i].id] = static_cast<uint16_t>(table_size);
+            table_size += size;
+        }
+
+        // The vtable comes immediately before the table, which must start suitably aligned for its largest field.
+        auto const vtable_size = sizeof(uint16_t) * (2 + slots.size());
+        pad(2);
+        while ((buffer_.size() + vtable_size) % alignment != 0)
+            buffer_.append(2, '\0');
+        auto const vtable_position = buffer_.size();
+        append<uint16_t>(static_cast<uint16_t>(vtable_size));
+        append<uint16_t>(static_cast<uint16_t>(table_size));
+        for (auto const slot : slots)
+            append(slot);
+
+        auto const table_position = buffer_.size();
+        buffer_.append(table_size, '\0');
+        write_at<int32_t>(table_position, static_cast<int32_t>(table_position - vtable_position));
+        for (size_t i = 0; i != fields.size(); ++i)
+        {
+            if (!fields[i].reference)
+                buffer_.replace(table_position + positions[i], fields[i].scalar.size(), fields[i].scalar);
+        }
+        for (size_t i = 0; i != fields.size(); ++i)
+        {
+            if (fields[i].reference)
+                patch(table_position + positions[i], fields[i].reference(*this));
+        }
+        return table_position;
+    }
+
+    size_t string_value(string_view const text)
+    {
+        pad(sizeof(uint32_t));
+        auto const position = buffer_.size();
+        append(static_cast<uint32_t>(text.size()));
+        buffer_ += text;
+        buffer_ += '\0';
+        return position;
+    }
+
+    size_t table_vector(vector<object> const & tables)
+    {
+        pad(sizeof(uint32_t));
+        auto const position = buffer_.size();
+        append(static_cast<uint32_t>(tables.size()));
+        buffer_.append(tables.size() * sizeof(uint32_t), '\0');
+        for (size_t i = 0; i != tables.size(); ++i)
+            patch(position + sizeof(uint32_t) * (i + 1), tables[i](*this));
+        return position;
+    }
+
+    // Writes a vector of structs made of two 64-bit integers, as used for Arrow field nodes and buffers.
+    size_t struct_vector(vector<pair<int64_t, int64_t>> const & structs)
+    {
+        while ((buffer_.size() + sizeof(uint32_t)) % sizeof(int64_t) != 0)
+            buffer_ += '\0';
+        auto const position = buffer_.size();
+        append(static_cast<uint32_t>(structs.size()));
+        for (auto const & [first, second] : structs)
+        {
+            append(first);
+            append(second);
+        }
+        return position;
+    }
+
+private:
+    template <typename T>
+    void append(T const value)
+    {
+        buffer_.append(sizeof(T), '\0');
+        write_at(buffer_.size() - sizeof(T), value);
+    }
+
+    template <typename T>
+    void write_at(size_t const position, T const value)
+    {
+        memcpy(buffer_.data() + position, &value, sizeof(T));
+    }
+
+    void patch(size_t const position, size_t const target)
+    {
+        write_at(position, static_cast<uint32_t>(target - position));
+    }
+
+    void pad(size_t const alignment)
+    {
+        while (buffer_.size() % alignment != 0)
+            buffer_ += '\0';
+    }
+
+    string buffer_;
+};
+
+size_t const maximum_batch_rows = 64 * 1024;
+size_t const maximum_batch_bytes = 64 * 1024 * 1024;
+uint8_t const message_schema = 1;
+uint8_t const message_dictionary_batch = 2;
+uint8_t const message_record_batch = 3;
+uint8_t const type_int = 2;
+uint8_t const type_utf8 = 5;
+uint8_t const type_bool = 6;
+int16_t const metadata_version_5 = 4;
+
+// Collects the buffers of a record batch into its message body.
+struct batch_body
+{
+    string data;
+    vector<pair<int64_t, int64_t>> nodes;
+    vector<pair<int64_t, int64_t>> buffers;
+
+    void add_buffer(string_view const bytes)
+    {
+        buffers.emplace_back(data.size(), bytes.size());
+        data += bytes;
+        data.append((8 - data.size() % 8) % 8, '\0');
+    }
+
+    template <typename T>
+    void add_values(vector<T> const & values)
+    {
+        add_buffer(string_view(reinterpret_cast<char const *>(values.data()), values.size() * sizeof(T)));
+    }
+
+    void add_bits(vector<bool> const & bits)
+    {
+        string bytes((bits.size() + 7) / 8, '\0');
+        for (size_t i = 0; i != bits.size(); ++i)
+        {
+            if (bits[i])
+                bytes[i / 8] |= static_cast<char>(1 << (i % 8));
+        }
+        add_buffer(bytes);
+    }
+
+    void add_strings(vector<int32_t> const & offsets, string_view const values)
+    {
+        nodes.emplace_back(offsets.size() - 1, 0);
+        add_buffer({});
+        add_values(offsets);
+        add_buffer(values);
+    }
+
+    void add_optional_strings(vector<int32_t> const & offsets, string_view const values, vector<bool> const & valid)
+    {
+        auto const null_count = count(begin(valid), end(valid), false);
+        nodes.emplace_back(valid.size(), null_count);
+        if (null_count > 0)
+            add_bits(valid);
+        else
+            add_buffer({});
+        add_values(offsets);
+        add_buffer(values);
+    }
+
+    void add_optional_integers(vector<optional<int64_t>> const & values)
+    {
+        vector<bool> valid(values.size());
+        vector<int64_t> data(values.size());
+        for (size_t i = 0; i != values.size(); ++i)
+        {
+            valid[i] = values[i].has_value();
+            data[i] = values[i].value_or(0);
+        }
+        auto const null_count = count(begin(valid), end(valid), false);
+        nodes.emplace_back(values.size(), null_count);
+        if (null_count > 0)
+            add_bits(valid);
+        else
+            add_buffer({});
+        add_values(data);
+    }
+};
+
+flatbuffer_writer::object write_int_type(int32_t const bit_width, bool const is_signed)
+{
+    return [=](flatbuffer_writer & fb) { return fb.table({ flatbuffer_writer::scalar<int32_t>(0, bit_width), flatbuffer_writer::scalar<uint8_t>(1, is_signed) }); };
+}
+
+flatbuffer_writer::object write_field(string const name, bool const nullable, uint8_t const type, flatbuffer_writer::object const type_table, optional<int64_t> const dictionary_id)
+{
+    return [=](flatbuffer_writer & fb) {
+        vector<flatbuffer_writer::field> fields{
+            flatbuffer_writer::reference(0, [&](flatbuffer_writer & fb) { return fb.string_value(name); }),
+            flatbuffer_writer::scalar<uint8_t>(1, nullable),
+            flatbuffer_writer::scalar<uint8_t>(2, type),
+            flatbuffer_writer::reference(3, type_table),
+            flatbuffer_writer::reference(5, [](flatbuffer_writer & fb) { return fb.table_vector({}); }) };
+        if (dictionary_id.has_value())
+        {
+            fields.push_back(flatbuffer_writer::reference(4, [&](flatbuffer_writer & fb) {
+                return fb.table({ flatbuffer_writer::scalar<int64_t>(0, dictionary_id.value()), flatbuffer_writer::reference(1, write_int_type(32, true)) });
+            }));
+        }
+        return fb.table(fields);
+    };
+}
+
+size_t write_schema(flatbuffer_writer & fb)
+{
+    auto const empty_table = [](flatbuffer_writer & fb) { return fb.table({}); };
+    vector<flatbuffer_writer::object> fields;
+    array<string, arrow_stream_writer::location_count> const location_names{ "server", "database", "schema", "table", "column" };
+    for (size_t i = 0; i != arrow_stream_writer::location_count; ++i)
+        fields.push_back(write_field(location_names[i], false, type_utf8, empty_table, static_cast<int64_t>(i)));
+    fields.push_back(write_field("value", false, type_utf8, empty_table, {}));
+    fields.push_back(write_field("truncated", false, type_bool, empty_table, {}));
+    fields.push_back(write_field("match_start", true, type_int, write_int_type(64, true), {}));
+    fields.push_back(write_field("match_end", true, type_int, write_int_type(64, true), {}));
+    fields.push_back(write_field("locator", true, type_utf8, empty_table, {}));
+    return fb.table({ flatbuffer_writer::scalar<int16_t>(0, 0), flatbuffer_writer::reference(1, [&](flatbuffer_writer & fb) { return fb.table_vector(fields); }) });
+}
+
+flatbuffer_writer::object write_record_batch(int64_t const length, batch_body const & body)
+{
+    return [length, &body](flatbuffer_writer & fb) {
+        return fb.table({
+            flatbuffer_writer::scalar<int64_t>(0, length),
+            flatbuffer_writer::reference(1, [&](flatbuffer_writer & fb) { return fb.struct_vector(body.nodes); }),
+            flatbuffer_writer::reference(2, [&](flatbuffer_writer & fb) { return fb.struct_vector(body.buffers); }) });
+    };
+}
+
+string get_message_metadata(uint8_t const header_type, flatbuffer_writer::object const & header, size_t const body_size)
+{
+    return flatbuffer_writer().finish([&](flatbuffer_writer & fb) {
+        return fb.table({
+            flatbuffer_writer::scalar<int16_t>(0, metadata_version_5),
+            flatbuffer_writer::scalar<uint8_t>(1, header_type),
+            flatbuffer_writer::reference(2, header),
+            flatbuffer_writer::scalar<int64_t>(3, static_cast<int64_t>(body_size)) });
+    });
+}
+
+int32_t arrow_dictionary::get_index(string const & value)
+{
+    auto const [existing, added] = indices_.emplace(value, static_cast<int32_t>(values_.size()));
+    if (added)
+        values_.push_back(value);
+    return existing->second;
+}
+
+arrow_stream_writer::arrow_stream_writer(function<void(string_view)> write_bytes) : write_bytes_(move(write_bytes))
+{
+    write_message(get_message_metadata(message_schema, write_schema, 0), {});
+}
+
+void arrow_stream_writer::add(location const & where, string_view const value, bool const truncated, optional<int64_t> const match_start, optional<int64_t> const match_end, optional<string> const & locator)
+{
+    for (size_t i = 0; i != location_count; ++i)
+        batch_.locations[i].push_back(dictionaries_[i].get_index(*where[i]));
+    batch_.values += value;
+    batch_.value_offsets.push_back(static_cast<int32_t>(batch_.values.size()));
+    batch_.truncated.push_back(truncated);
+    batch_.match_starts.push_back(match_start);
+    batch_.match_ends.push_back(match_end);
+    if (locator.has_value())
+        batch_.locators += locator.value();
+    batch_.locator_offsets.push_back(static_cast<int32_t>(batch_.locators.size()));
+    batch_.has_locator.push_back(locator.has_value());
+    if (batch_.truncated.size() == maximum_batch_rows || batch_.values.size() >= maximum_batch_bytes)
+        write_batch();
+}
+
+void arrow_stream_writer::finish()
+{
+    write_batch();
+    write_bytes_(string_view("\xff\xff\xff\xff\0\0\0\0", 8));
+}
+
+void arrow_stream_writer::write_message(string_view const metadata, string_view const body)
+{
+    uint32_t const continuation = 0xffffffff;
+    auto const metadata_size = static_cast<int32_t>(metadata.size());
+    write_bytes_(string_view(reinterpret_cast<char const *>(&continuation), sizeof(continuation)));
+    write_bytes_(string_view(reinterpret_cast<char const *>(&metadata_size), sizeof(metadata_size)));
+    write_bytes_(metadata);
+    write_bytes_(body);
+}
+
+void arrow_stream_writer::write_dictionary_deltas()
+{
+    for (size_t i = 0; i != location_count; ++i)
+    {
+        auto& dictionary = dictionaries_[i];
+        auto const & values = dictionary.get_values();
+        if (dictionary.get_sent() == values.size())
+            continue;
+
+        string data;
+        vector<int32_t> offsets{ 0 };
+        for (auto value = begin(values) + dictionary.get_sent(); value != end(values); ++value)
+        {
+            data += *value;
+            offsets.push_back(static_cast<int32_t>(data.size()));
+        }
+        batch_body body;
+        body.add_strings(offsets, data);
+        auto const is_delta = dictionary.get_sent() > 0;
+        auto const length = static_cast<int64_t>(offsets.size() - 1);
+        auto const metadata = get_message_metadata(message_dictionary_batch, [&](flatbuffer_writer & fb) {
+            return fb.table({
+                flatbuffer_writer::scalar<int64_t>(0, static_cast<int64_t>(i)),
+                flatbuffer_writer::reference(1, write_record_batch(length, body)),
+                flatbuffer_writer::scalar<uint8_t>(2, is_delta) });
+        }, body.data.size());
+        write_message(metadata, body.data);
+        dictionary.mark_sent();
+    }
+}
+
+void arrow_stream_writer::write_batch()
+{
+    auto const length = static_cast<int64_t>(batch_.truncated.size());
+    if (length == 0)
+        return;
+
+    write_dictionary_deltas();
+    batch_body body;
+    for (auto const & indices : batch_.locations)
+    {
+        body.nodes.emplace_back(length, 0);
+        body.add_buffer({});
+        body.add_values(indices);
+    }
+    body.add_strings(batch_.value_offsets, batch_.values);
+    body.nodes.emplace_back(length, 0);
+    body.add_buffer({});
+    body.add_bits(batch_.truncated);
+    body.add_optional_integers(batch_.match_starts);
+    body.add_optional_integers(batch_.match_ends);
+    body.add_optional_strings(batch_.locator_offsets, batch_.locators, batch_.has_locator);
+    write_message(get_message_metadata(message_record_batch, write_record_batch(length, body), body.data.size()), body.data);
+    batch_ = record_batch();
+}
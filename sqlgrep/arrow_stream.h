@@ -0,0 +1,55 @@
+#ifndef ARROW_STREAM_H
+#define ARROW_STREAM_H
+
+// Gives each distinct string an index, remembering which strings have not yet been sent to the reader.
+class arrow_dictionary
+{
+public:
+    int32_t get_index(std::string const & value);
+    std::vector<std::string> const & get_values() const { return values_; }
+    size_t get_sent() const { return sent_; }
+    void mark_sent() { sent_ = values_.size(); }
+
+private:
+    std::unordered_map<std::string, int32_t> indices_;
+    std::vector<std::string> values_;
+    size_t sent_ = 0;
+};
+
+// Writes matches as an Arrow IPC stream. The location of each match is dictionary encoded, with new
+// names sent as dictionary deltas ahead of each record batch.
+class arrow_stream_writer
+{
+public:
+    static size_t const location_count = 5;
+    using location = std::array<std::string const *, location_count>;
+
+    explicit arrow_stream_writer(std::function<void(std::string_view)> write_bytes);
+
+    void add(location const & where, std::string_view value, bool truncated, std::optional<int64_t> match_start, std::optional<int64_t> match_end, std::optional<std::string> const & locator);
+    void finish();
+
+private:
+    struct record_batch
+    {
+        std::array<std::vector<int32_t>, location_count> locations;
+        std::string values;
+        std::vector<int32_t> value_offsets{ 0 };
+        std::vector<bool> truncated;
+        std::vector<std::optional<int64_t>> match_starts;
+        std::vector<std::optional<int64_t>> match_ends;
+        std::string locators;
+        std::vector<int32_t> locator_offsets{ 0 };
+        std::vector<bool> has_locator;
+    };
+
+    void write_message(std::string_view metadata, std::string_view body);
+    void write_dictionary_deltas();
+    void write_batch();
+
+    std::function<void(std::string_view)> const write_bytes_;
+    std::array<arrow_dictionary, location_count> dictionaries_;
+    record_batch batch_;
+};
+
+#endif //ARROW_STREAM_H
@@ -0,0 +1,62 @@
+#include "pch.h"
+#include "search_types.h"
+#include "work_queue.h"
+#include "attempt_registry.h"
+
+using namespace std;
+
+bool attempt_registry::start_attempt(work_item const & item)
+{
+    lock_guard<mutex> lock(mutex_);
+    auto& column = columns_[item.column_index];
+    if (column.finished)
+        return false;
+    if (column.running++ == 0)
+    {
+        column.started_at = chrono::steady_clock::now();
+        column.hedged = false;
+        column.item = item;
+        running_.insert(item.column_index);
+    }
+    return true;
+}
+
+bool attempt_registry::attach(size_t const column_index, SQLHSTMT const statement)
+{
+    lock_guard<mutex> lock(mutex_);
+    auto& column = columns_[column_index];
+    if (column.finished)
+        return false;
+    column.statements.push_back(statement);
+    return true;
+}
+
+void attempt_registry::detach(size_t const column_index, SQLHSTMT const statement)
+{
+    lock_guard<mutex> lock(mutex_);
+    auto& statements = columns_[column_index].statements;
+    statements.erase(remove(begin(statements), end(statements), statement), end(statements));
+}
+
+bool attempt_registry::end_attempt(size_t const column_index, bool const succeeded)
+{
+    lock_guard<mutex> lock(mutex_);
+    auto& column = columns_[column_index];
+    if (--column.running == 0)
+        running_.erase(column_index);
+    if (column.finished)
+        return false;
+    if (!succeeded)
+        return column.running == 0;
+
+    column.finished = true;
+    for (auto const statement : column.statements)
+        SQLCancel(statement);
+    return true;
+}
+
+void attempt_registry::finish(size_t const column_index)
+{
+    lock_guard<mutex> lock(mutex_);
+    columns_[column_index].finished = true;
+}
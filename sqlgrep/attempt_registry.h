@@ -0,0 +1,56 @@
+#ifndef ATTEMPT_REGISTRY_H
+#define ATTEMPT_REGISTRY_H
+
+// Tracks the attempts at searching each column. A slow search can be hedged by starting another attempt
+// on a different endpoint; the first attempt to finish wins and the others are cancelled with SQLCancel,
+// which ODBC allows to be called from any thread.
+class attempt_registry
+{
+public:
+    explicit attempt_registry(size_t const number_of_columns) : columns_(number_of_columns) {}
+
+    bool start_attempt(work_item const & item);
+    bool attach(size_t column_index, SQLHSTMT statement);
+    void detach(size_t column_index, SQLHSTMT statement);
+
+    // Returns whether this attempt decides the outcome of the column, either because it is the first to
+    // succeed or because it failed and no other attempt is still running.
+    bool end_attempt(size_t column_index, bool succeeded);
+
+    void finish(size_t column_index);
+
+    template <typename IsStraggler>
+    std::vector<work_item> take_stragglers(IsStraggler const & is_straggler)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto const now = std::chrono::steady_clock::now();
+        std::vector<work_item> stragglers;
+        for (auto const index : running_)
+        {
+            auto& column = columns_[index];
+            if (!column.hedged && is_straggler(index, now - column.started_at))
+            {
+                column.hedged = true;
+                stragglers.push_back(column.item);
+            }
+        }
+        return stragglers;
+    }
+
+private:
+    struct column_attempts
+    {
+        int running = 0;
+        bool finished = false;
+        bool hedged = false;
+        std::chrono::steady_clock::time_point started_at;
+        work_item item;
+        std::vector<SQLHSTMT> statements;
+    };
+
+    std::mutex mutex_;
+    std::vector<column_attempts> columns_;
+    std::unordered_set<size_t> running_;
+};
+
+#endif //ATTEMPT_REGISTRY_H
@@ -0,0 +1,56 @@
+#ifndef BLOCKING_QUEUE_H
+#define BLOCKING_QUEUE_H
+
+// A queue that waits for items to arrive and, when given a capacity, for space to add more.
+template <typename T>
+class blocking_queue
+{
+public:
+    blocking_queue() = default;
+    explicit blocking_queue(size_t const capacity) : capacity_(capacity) {}
+
+    void push(T item)
+    {
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            space_.wait(lock, [this] { return capacity_ == 0 || items_.size() < capacity_ || closed_; });
+            if (closed_)
+                return;
+            items_.push_back(std::move(item));
+        }
+        available_.notify_one();
+    }
+
+    // Stops waiting for space and discards anything pushed from now on.
+    void close()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            closed_ = true;
+        }
+        space_.notify_all();
+    }
+
+    T pop()
+    {
+        T item;
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            available_.wait(lock, [this] { return !items_.empty(); });
+            item = std::move(items_.front());
+            items_.pop_front();
+        }
+        space_.notify_one();
+        return item;
+    }
+
+private:
+    size_t const capacity_ = 0;
+    std::mutex mutex_;
+    std::condition_variable available_;
+    std::condition_variable space_;
+    std::deque<T> items_;
+    bool closed_ = false;
+};
+
+#endif //BLOCKING_QUEUE_H
@@ -0,0 +1,53 @@
+#include "pch.h"
+#include "budgets.h"
+
+using namespace std;
+
+void read_budget::consume(uint64_t bytes)
+{
+    if (bytes_per_second_ <= 0)
+        return;
+
+    chrono::steady_clock::time_point start_at;
+    {
+        lock_guard<mutex> lock(mutex_);
+        auto const now = chrono::steady_clock::now();
+        if (next_available_ < now)
+            next_available_ = now;
+        start_at = next_available_;
+        next_available_ += chrono::duration_cast<chrono::steady_clock::duration>(chrono::duration<double>(bytes / bytes_per_second_));
+    }
+    this_thread::sleep_until(start_at);
+}
+
+cost_budget::cost_budget(size_t const number_of_columns, double const seconds, double const megabytes)
+    : deadline_(seconds > 0 ? chrono::steady_clock::now() + chrono::duration_cast<chrono::steady_clock::duration>(chrono::duration<double>(seconds)) : optional<chrono::steady_clock::time_point>()),
+      bytes_(static_cast<uint64_t>(megabytes * 1024 * 1024)), decided_(number_of_columns)
+{
+}
+
+bool cost_budget::is_limited() const
+{
+    return deadline_.has_value() || bytes_ > 0;
+}
+
+optional<string> cost_budget::admit(size_t const column_index, uint64_t const bytes, optional<chrono::duration<double>> const estimated_duration)
+{
+    lock_guard<mutex> lock(mutex_);
+    if (decided_[column_index])
+        return {};
+    if (deadline_.has_value())
+    {
+        auto const now = chrono::steady_clock::now();
+        if (now >= deadline_.value())
+            return "the time budget ran out"s;
+        if (estimated_duration.has_value() && now + chrono::duration_cast<chrono::steady_clock::duration>(estimated_duration.value()) > deadline_.value())
+            return "it would not finish within the time budget"s;
+    }
+    if (bytes_ > 0 && used_bytes_ + bytes > bytes_)
+        return "it would exceed the I/O budget"s;
+
+    used_bytes_ += bytes;
+    decided_[column_index] = true;
+    return {};
+}
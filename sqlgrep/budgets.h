@@ -0,0 +1,39 @@
+#ifndef BUDGETS_H
+#define BUDGETS_H
+
+// Paces scans so that, on average, no more than the given number of bytes per second are read
+// by the server on our behalf. Each scan reserves its table size and waits for its turn.
+class read_budget
+{
+public:
+    explicit read_budget(double megabytes_per_second) : bytes_per_second_(megabytes_per_second * 1024 * 1024) {}
+
+    void consume(uint64_t bytes);
+
+private:
+    std::mutex mutex_;
+    double const bytes_per_second_;
+    std::chrono::steady_clock::time_point next_available_;
+};
+
+// Decides which columns fit in the time and I/O budgets for the whole search. Each column is decided
+// once, so a retry or hedge of a column that was admitted is not counted again.
+class cost_budget
+{
+public:
+    cost_budget(size_t number_of_columns, double seconds, double megabytes);
+
+    bool is_limited() const;
+
+    // Returns why the column cannot be searched, or nothing if it fits in the budget.
+    std::optional<std::string> admit(size_t column_index, uint64_t bytes, std::optional<std::chrono::duration<double>> estimated_duration);
+
+private:
+    std::mutex mutex_;
+    std::optional<std::chrono::steady_clock::time_point> const deadline_;
+    uint64_t const bytes_;
+    uint64_t used_bytes_ = 0;
+    std::vector<bool> decided_;
+};
+
+#endif //BUDGETS_H
@@ -0,0 +1,115 @@
+#include "pch.h"
+#include "search_types.h"
+#include "catalog_cache.h"
+#include "file_formats.h"
+#include "messages.h"
+
+using namespace std;
+
+catalog_cache::catalog_cache(string path) : path_(move(path))
+{
+    ifstream file(path_);
+    string line;
+    string current;
+    while (getline(file, line))
+    {
+        auto const fields = split_fields(line);
+        if (fields[0] == "driver" && fields.size() == 2)
+        {
+            driver_ = unescape_field(fields[1]);
+        }
+        else if (fields[0] == "database")
+        {
+            current.clear();
+            if (fields.size() != 7)
+            {
+                write_verbose("Ignoring an unreadable database in the catalog cache " + path_ + ".");
+                continue;
+            }
+            current = get_key(unescape_field(fields[1]), unescape_field(fields[2]));
+            databases_[current] = { unescape_field(fields[3]), unescape_field(fields[4]), unescape_field(fields[5]), fields[6] == "1", {} };
+        }
+        else if (fields[0] == "column" && !current.empty())
+        {
+            try
+            {
+                databases_[current].columns.push_back(parse_column(fields));
+            }
+            catch (logic_error const &)
+            {
+                // Searching only the columns that could be read would miss matches, so the database is discovered again.
+                write_verbose("Ignoring an unreadable database in the catalog cache " + path_ + ".");
+                databases_.erase(current);
+                current.clear();
+            }
+        }
+    }
+}
+
+optional<string> catalog_cache::get_driver() const
+{
+    return driver_.empty() ? optional<string>() : driver_;
+}
+
+void catalog_cache::set_driver(string driver)
+{
+    driver_ = move(driver);
+    changed_ = true;
+}
+
+optional<catalog_cache::cached_database> catalog_cache::find(string const & server, string const & database, string const & marker, bool const locate_rows) const
+{
+    lock_guard<mutex> lock(mutex_);
+    auto const found = databases_.find(get_key(server, database));
+    if (found == databases_.end() || found->second.marker != marker || (locate_rows && !found->second.has_locators))
+        return {};
+
+    auto entry = found->second;
+    if (!locate_rows)
+    {
+        for (auto& column : entry.columns)
+            column.locator.clear();
+    }
+    return entry;
+}
+
+void catalog_cache::store(string const & server, string const & database, cached_database entry)
+{
+    lock_guard<mutex> lock(mutex_);
+    databases_[get_key(server, database)] = move(entry);
+    changed_ = true;
+}
+
+void catalog_cache::save() const
+{
+    if (!changed_)
+        return;
+
+    string contents;
+    if (!driver_.empty())
+        contents += "driver\t" + escape_field(driver_) + "\n";
+    for (auto const & [key, entry] : databases_)
+    {
+        contents += fmt::format("database\t{}\t{}\t{}\t{}\t{}\n", key, escape_field(entry.marker), escape_field(entry.isolation_level_command),
+            escape_field(entry.schema_fingerprint), entry.has_locators ? 1 : 0);
+        for (auto const & column : entry.columns)
+        {
+            contents += fmt::format("column\t{}\t{}\t{}\t{}\t{}\t{}\t{}\t{}\t{}\n", escape_field(column.schema), escape_field(column.table), escape_field(column.column),
+                column.number_of_rows, column.number_of_bytes, escape_field(column.data_space), escape_field(column.locator), escape_field(column.data_type), column.maximum_length);
+        }
+    }
+    replace_file(path_, contents);
+}
+
+string catalog_cache::get_key(string const & server, string const & database)
+{
+    return escape_field(server) + "\t" + escape_field(database);
+}
+
+column_details catalog_cache::parse_column(vector<string> const & fields)
+{
+    if (fields.size() != 10)
+        throw invalid_argument("A cached column has the wrong number of fields.");
+    return { unescape_field(fields[1]), unescape_field(fields[2]), unescape_field(fields[3]), stoull(fields[4]), stoull(fields[5]),
+        unescape_field(fields[6]), 0, unescape_field(fields[7]), unescape_field(fields[8]), stoi(fields[9]) };
+}
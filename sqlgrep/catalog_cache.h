@@ -0,0 +1,39 @@
+#ifndef CATALOG_CACHE_H
+#define CATALOG_CACHE_H
+
+// Keeps the string columns, table sizes and isolation level found in each database between runs, for --catalog-cache.
+class catalog_cache
+{
+public:
+    struct cached_database
+    {
+        std::string marker;
+        std::string isolation_level_command;
+        std::string schema_fingerprint;
+        bool has_locators;
+        std::vector<column_details> columns;
+    };
+
+    explicit catalog_cache(std::string path);
+
+    std::optional<std::string> get_driver() const;
+    void set_driver(std::string driver);
+
+    // Returns the cached catalog if the schema has not changed since it was stored. Row locators are only
+    // returned when they are wanted, as a catalog cached by a --locate run has them for every column.
+    std::optional<cached_database> find(std::string const & server, std::string const & database, std::string const & marker, bool locate_rows) const;
+    void store(std::string const & server, std::string const & database, cached_database entry);
+    void save() const;
+
+private:
+    static std::string get_key(std::string const & server, std::string const & database);
+    static column_details parse_column(std::vector<std::string> const & fields);
+
+    std::string const path_;
+    std::string driver_;
+    std::map<std::string, cached_database> databases_;
+    bool changed_ = false;
+    mutable std::mutex mutex_;
+};
+
+#endif //CATALOG_CACHE_H
@@ -0,0 +1,86 @@
+#include "pch.h"
+#include "search_types.h"
+#include "cost_model.h"
+#include "file_formats.h"
+#include "messages.h"
+
+using namespace std;
+
+cost_model::cost_model(string path) : path_(move(path))
+{
+    ifstream file(path_);
+    string line;
+    while (getline(file, line))
+    {
+        auto const fields = split_fields(line);
+        if (fields.size() != 8)
+            continue;
+        try
+        {
+            history_[fields[0] + '\t' + fields[1] + '\t' + fields[2] + '\t' + fields[3] + '\t' + fields[4]] = { stod(fields[5]), stoull(fields[6]), stoull(fields[7]) };
+        }
+        catch (logic_error const &)
+        {
+            write_verbose("Ignoring an unreadable line in the stats file " + path_ + ".");
+        }
+    }
+}
+
+string cost_model::get_key(string_view const server, string_view const database, column_details const & column, string_view const query_shape)
+{
+    return escape_field(server) + '\t' + escape_field(database) + '\t' + escape_field(column.schema) + '\t' + escape_field(column.table) + '\t' + string(query_shape);
+}
+
+optional<double> cost_model::predict_seconds(string const & key, uint64_t const bytes) const
+{
+    auto const found = history_.find(key);
+    if (found != history_.end())
+    {
+        auto const & cost = found->second;
+        return cost.bytes == 0 ? cost.seconds : cost.seconds * max(bytes, uint64_t{ 1 }) / cost.bytes;
+    }
+
+    double total_seconds = 0;
+    uint64_t total_bytes = 0;
+    for (auto const & [table, cost] : history_)
+    {
+        total_seconds += cost.seconds;
+        total_bytes += cost.bytes;
+    }
+    if (total_bytes == 0)
+        return {};
+    return total_seconds * bytes / total_bytes;
+}
+
+void cost_model::record(string const & key, double const seconds, uint64_t const rows, uint64_t const bytes)
+{
+    auto& measured = measured_[key];
+    measured.seconds += seconds;
+    measured.rows = rows;
+    measured.bytes = bytes;
+    ++measured.scans;
+}
+
+void cost_model::save()
+{
+    double const weight_of_latest_run = 0.5;
+    for (auto const & [key, measured] : measured_)
+    {
+        table_cost const latest{ measured.seconds / measured.scans, measured.rows, measured.bytes };
+        auto const previous = history_.find(key);
+        if (previous == history_.end())
+        {
+            history_[key] = latest;
+            continue;
+        }
+        auto& cost = previous->second;
+        cost.seconds = weight_of_latest_run * latest.seconds + (1 - weight_of_latest_run) * cost.seconds;
+        cost.rows = latest.rows;
+        cost.bytes = latest.bytes;
+    }
+
+    string contents;
+    for (auto const & [key, cost] : history_)
+        contents += fmt::format("{}\t{}\t{}\t{}\n", key, cost.seconds, cost.rows, cost.bytes);
+    replace_file(path_, contents);
+}
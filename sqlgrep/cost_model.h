@@ -0,0 +1,42 @@
+#ifndef COST_MODEL_H
+#define COST_MODEL_H
+
+// Remembers how long each table took to search in earlier runs, so that the longest searches can be
+// started first and the time remaining estimated before any have finished. Each run's measurements are
+// blended into the history, so older runs count for less and less.
+class cost_model
+{
+public:
+    explicit cost_model(std::string path);
+
+    static std::string get_key(std::string_view server, std::string_view database, column_details const & column, std::string_view query_shape);
+
+    // Predicts from the table's own history, scaled by how much it has grown, or from the average
+    // speed of all tables if it has never been searched.
+    std::optional<double> predict_seconds(std::string const & key, uint64_t bytes) const;
+
+    void record(std::string const & key, double seconds, uint64_t rows, uint64_t bytes);
+    void save();
+
+private:
+    struct table_cost
+    {
+        double seconds;
+        uint64_t rows;
+        uint64_t bytes;
+    };
+
+    struct measurement
+    {
+        double seconds = 0;
+        uint64_t rows = 0;
+        uint64_t bytes = 0;
+        int scans = 0;
+    };
+
+    std::string const path_;
+    std::map<std::string, table_cost> history_;
+    std::map<std::string, measurement> measured_;
+};
+
+#endif //COST_MODEL_H
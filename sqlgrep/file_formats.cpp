@@ -0,0 +1,87 @@
+#include "pch.h"
+#include "file_formats.h"
+#include "sqlgrep.h"
+
+using namespace std;
+
+void replace_file(string const & path, string_view const contents)
+{
+    auto const temporary_path = path + ".new";
+    {
+        ofstream file(temporary_path, ios::binary | ios::trunc);
+        file.write(contents.data(), static_cast<streamsize>(contents.size()));
+        if (!file)
+            throw runtime_error("Unable to write " + temporary_path + ".");
+    }
+    if (!replace_with(temporary_path, path))
+        throw runtime_error("Unable to replace " + path + ".");
+}
+
+string escape_field(string_view const text)
+{
+    string escaped;
+    for (auto const c : text)
+    {
+        if (c == '\t' || c == '\n' || c == '\r' || c == '%')
+            escaped += fmt::format("%{:02x}", static_cast<int>(static_cast<unsigned char>(c)));
+        else
+            escaped += c;
+    }
+    return escaped;
+}
+
+string unescape_field(string_view const text)
+{
+    string unescaped;
+    for (size_t i = 0; i < text.size(); ++i)
+    {
+        if (text[i] == '%' && i + 2 < text.size() && isxdigit(static_cast<unsigned char>(text[i + 1])) && isxdigit(static_cast<unsigned char>(text[i + 2])))
+        {
+            unescaped += static_cast<char>(stoi(string(text.substr(i + 1, 2)), nullptr, 16));
+            i += 2;
+        }
+        else
+        {
+            unescaped += text[i];
+        }
+    }
+    return unescaped;
+}
+
+vector<string> split_fields(string const & line)
+{
+    vector<string> fields;
+    size_t start = 0;
+    for (auto tab = line.find('\t'); tab != string::npos; tab = line.find('\t', start))
+    {
+        fields.push_back(line.substr(start, tab - start));
+        start = tab + 1;
+    }
+    fields.push_back(line.substr(start));
+    return fields;
+}
+
+string escape_json_string(string_view const text)
+{
+    string escaped;
+    escaped.reserve(text.size() + 2);
+    escaped += '"';
+    for (auto const c : text)
+    {
+        switch (c)
+        {
+        case '"': escaped += "\\\""; break;
+        case '\\': escaped += "\\\\"; break;
+        case '\n': escaped += "\\n"; break;
+        case '\r': escaped += "\\r"; break;
+        case '\t': escaped += "\\t"; break;
+        default:
+            if (static_cast<unsigned char>(c) < 0x20)
+                escaped += fmt::format("\\u{:04x}", static_cast<int>(c));
+            else
+                escaped += c;
+        }
+    }
+    escaped += '"';
+    return escaped;
+}
@@ -0,0 +1,16 @@
+#ifndef FILE_FORMATS_H
+#define FILE_FORMATS_H
+
+// Replaces a file only once its new contents have been written in full, so that anything reading it never
+// sees it half written.
+void replace_file(std::string const & path, std::string_view contents);
+
+// Fields in the tab-separated files kept between runs are percent-escaped so that names can hold any character.
+std::string escape_field(std::string_view text);
+std::string unescape_field(std::string_view text);
+std::vector<std::string> split_fields(std::string const & line);
+
+// Returns the text as a quoted JSON string.
+std::string escape_json_string(std::string_view text);
+
+#endif //FILE_FORMATS_H
@@ -1,3 +1,6 @@
+#include <cstdio>
+#include <string>
+#include <unistd.h>
 #include "fmt/format.h"
 
 auto set_up_console()
@@ -9,3 +12,23 @@ auto on_driver_not_found()
     fmt::print(stderr, "WARNING: No ODBC driver found. Please install it using these instructions: https://docs.microsoft.com/en-us/sql/connect/odbc/linux-mac/installing-the-microsoft-odbc-driver-for-sql-server?view=sql-server-2017\n");
 }
 
+auto is_terminal(FILE * stream)
+{
+    return isatty(fileno(stream)) != 0;
+}
+
+auto set_binary_mode(FILE *)
+{
+}
+
+// rename replaces an existing file atomically.
+auto replace_with(std::string const & from, std::string const & to)
+{
+    return rename(from.c_str(), to.c_str()) == 0;
+}
+
+// Command line arguments are already UTF-8.
+auto to_utf8(std::string const & text)
+{
+    return text;
+}
@@ -0,0 +1,215 @@
+#include "pch.h"
+#include "search_types.h"
+#include "blocking_queue.h"
+#include "work_queue.h"
+#include "attempt_registry.h"
+#include "budgets.h"
+#include "query_metrics.h"
+#include "search_job.h"
+#include "match_writers.h"
+#include "arrow_stream.h"
+#include "file_formats.h"
+#include "messages.h"
+#include "trace.h"
+
+using namespace std;
+
+buffered_output::~buffered_output()
+{
+    hand_off();
+    {
+        lock_guard<mutex> lock(mutex_);
+        stopping_ = true;
+    }
+    changed_.notify_all();
+    writer_.join();
+}
+
+void buffered_output::write_bytes(string_view const bytes)
+{
+    buffer_.append(bytes.data(), bytes.data() + bytes.size());
+    if (buffer_.size() >= block_size)
+        hand_off();
+}
+
+void buffered_output::flush()
+{
+    trace_span span("flush output", "output");
+    hand_off();
+    unique_lock<mutex> lock(mutex_);
+    changed_.wait(lock, [this] { return blocks_.empty() && !writing_; });
+}
+
+void buffered_output::hand_off()
+{
+    if (buffer_.size() == 0)
+        return;
+
+    string block(buffer_.data(), buffer_.size());
+    buffer_.clear();
+    {
+        unique_lock<mutex> lock(mutex_);
+        changed_.wait(lock, [this] { return blocks_.size() < maximum_queued_blocks; });
+        blocks_.push_back(move(block));
+    }
+    changed_.notify_all();
+}
+
+void buffered_output::run()
+{
+    name_trace_thread("output writer");
+    unique_lock<mutex> lock(mutex_);
+    while (true)
+    {
+        changed_.wait(lock, [this] { return !blocks_.empty() || stopping_; });
+        if (blocks_.empty())
+            return;
+
+        auto block = move(blocks_.front());
+        blocks_.pop_front();
+        writing_ = true;
+        lock.unlock();
+        changed_.notify_all();
+        {
+            trace_span span("write output", "output");
+            fwrite(block.data(), 1, block.size(), stream_);
+            fflush(stream_);
+        }
+        lock.lock();
+        writing_ = false;
+        changed_.notify_all();
+    }
+}
+
+class text_match_writer : public match_writer
+{
+public:
+    explicit text_match_writer(buffered_output & output) : output_(output) {}
+
+    void write(search_job const & job, match_details const & match) override
+    {
+        // Streamed matches arrive in batches, and the column only needs to be named before the first of them.
+        auto heading = get_location_prefix(job, match.column) + match.column.table + "." + match.column.column;
+        if (heading != last_heading_)
+            output_.write("{}\n", format_colour(heading, fmt::color::magenta));
+        last_heading_ = move(heading);
+        for (auto const & found : match.matches)
+        {
+            output_.write("    {}{}{}\n", found.value, found.truncated ? "... <truncated>" : "", found.locator.has_value() ? "  [" + found.locator.value() + "]" : ""s);
+        }
+
+        if (match.more_matches_available)
+            output_.write("{}\n", format_colour("    ... more available", fmt::color::green));
+    }
+
+private:
+    buffered_output & output_;
+    string last_heading_;
+};
+
+// Writes one JSON object per line for each match.
+class jsonl_match_writer : public match_writer
+{
+public:
+    explicit jsonl_match_writer(buffered_output & output) : output_(output) {}
+
+    void write(search_job const & job, match_details const & match) override
+    {
+        auto const & target = job.targets[match.column.target];
+        auto const prefix = fmt::format(R"({{"server":{},"database":{},"schema":{},"table":{},"column":{})", escape_json_string(job.servers[target.server].name), escape_json_string(target.database),
+            escape_json_string(match.column.schema), escape_json_string(match.column.table), escape_json_string(match.column.column));
+        for (auto const & found : match.matches)
+        {
+            auto const end_offset = found.offset.has_value() ? to_string(found.offset.value() + job.match_text.size()) : "null"s;
+            auto const locator = found.locator.has_value() ? escape_json_string(found.locator.value()) : "null"s;
+            output_.write(R"({},"value":{},"truncated":{},"match_start":{},"match_end":{},"locator":{}}})" "\n", prefix, escape_json_string(found.value), found.truncated,
+                found.offset.has_value() ? to_string(found.offset.value()) : "null"s, end_offset, locator);
+        }
+    }
+
+private:
+    buffered_output & output_;
+};
+
+auto escape_csv_field(string_view const text)
+{
+    if (text.find_first_of(",\"\r\n") == string_view::npos)
+        return string(text);
+
+    string escaped = "\"";
+    for (auto const c : text)
+    {
+        if (c == '"')
+            escaped += '"';
+        escaped += c;
+    }
+    return escaped + "\"";
+}
+
+// Writes RFC 4180 CSV with a header row and one row for each match.
+class csv_match_writer : public match_writer
+{
+public:
+    explicit csv_match_writer(buffered_output & output) : output_(output)
+    {
+        output_.write("server,database,schema,table,column,value,truncated,match_start,match_end,locator\r\n");
+    }
+
+    void write(search_job const & job, match_details const & match) override
+    {
+        auto const & target = job.targets[match.column.target];
+        auto const prefix = fmt::format("{},{},{},{},{}", escape_csv_field(job.servers[target.server].name), escape_csv_field(target.database),
+            escape_csv_field(match.column.schema), escape_csv_field(match.column.table), escape_csv_field(match.column.column));
+        for (auto const & found : match.matches)
+        {
+            auto const start_offset = found.offset.has_value() ? to_string(found.offset.value()) : ""s;
+            auto const end_offset = found.offset.has_value() ? to_string(found.offset.value() + job.match_text.size()) : ""s;
+            output_.write("{},{},{},{},{},{}\r\n", prefix, escape_csv_field(found.value), found.truncated, start_offset, end_offset, escape_csv_field(found.locator.value_or(""s)));
+        }
+    }
+
+private:
+    buffered_output & output_;
+};
+
+// Writes matches as an Arrow IPC stream.
+class arrow_match_writer : public match_writer
+{
+public:
+    explicit arrow_match_writer(buffered_output & output) : stream_([&output](string_view const bytes) { output.write_bytes(bytes); }) {}
+
+    void write(search_job const & job, match_details const & match) override
+    {
+        auto const & target = job.targets[match.column.target];
+        arrow_stream_writer::location const location{ &job.servers[target.server].name, &target.database, &match.column.schema, &match.column.table, &match.column.column };
+        for (auto const & found : match.matches)
+        {
+            auto const match_start = found.offset.has_value() ? optional<int64_t>(found.offset.value()) : optional<int64_t>();
+            auto const match_end = found.offset.has_value() ? optional<int64_t>(found.offset.value() + job.match_text.size()) : optional<int64_t>();
+            stream_.add(location, found.value, found.truncated, match_start, match_end, found.locator);
+        }
+    }
+
+    void finish() override
+    {
+        stream_.finish();
+    }
+
+private:
+    arrow_stream_writer stream_;
+};
+
+unique_ptr<match_writer> create_match_writer(output_format const format, buffered_output & output)
+{
+    switch (format)
+    {
+    case output_format::jsonl:
+        return make_unique<jsonl_match_writer>(output);
+    case output_format::csv:
+        return make_unique<csv_match_writer>(output);
+    case output_format::arrow:
+        return make_unique<arrow_match_writer>(output);
+    default:
+        return make_unique<text_match_writer>(output);
+    }
+}
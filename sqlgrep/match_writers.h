@@ -0,0 +1,63 @@
+#ifndef MATCH_WRITERS_H
+#define MATCH_WRITERS_H
+
+enum class output_format
+{
+    text,
+    jsonl,
+    csv,
+    arrow
+};
+
+// Collects output in memory and hands it in large blocks to a thread that writes it, so that a slow
+// terminal or a full pipe holds up neither the search nor the formatting of further matches until
+// the queue of blocks is full.
+class buffered_output
+{
+public:
+    explicit buffered_output(FILE * stream) : stream_(stream), writer_([this] { run(); }) {}
+    ~buffered_output();
+
+    buffered_output(buffered_output const &) = delete;
+    buffered_output & operator=(buffered_output const &) = delete;
+
+    template <typename... Args>
+    void write(fmt::format_string<Args...> format, Args&&... args)
+    {
+        fmt::format_to(std::back_inserter(buffer_), format, std::forward<Args>(args)...);
+        if (buffer_.size() >= block_size)
+            hand_off();
+    }
+
+    void write_bytes(std::string_view bytes);
+
+    // Waits until everything written so far has reached the stream.
+    void flush();
+
+private:
+    void hand_off();
+    void run();
+
+    static size_t const block_size = 64 * 1024;
+    static size_t const maximum_queued_blocks = 64;
+    FILE * const stream_;
+    fmt::memory_buffer buffer_;
+    std::mutex mutex_;
+    std::condition_variable changed_;
+    std::deque<std::string> blocks_;
+    bool writing_ = false;
+    bool stopping_ = false;
+    std::thread writer_;
+};
+
+class match_writer
+{
+public:
+    virtual ~match_writer() = default;
+    virtual void write(search_job const & job, match_details const & match) = 0;
+    virtual void finish() {}
+};
+
+std::unique_ptr<match_writer> create_match_writer(output_format format, buffered_output & output);
+
+#endif //MATCH_WRITERS_H
@@ -0,0 +1,32 @@
+#include "pch.h"
+#include "messages.h"
+
+using namespace std;
+
+bool verbose_messages_enabled = false;
+FILE * status_output = stdout;
+bool status_is_terminal = true;
+string const clear_eol = "\033[0K"s;
+
+string format_colour(string_view const message, fmt::color colour)
+{
+    return status_is_terminal ? clear_eol + fmt::format(fmt::fg(colour), "{}", message) : string(message);
+}
+
+void write_colour(string_view const message, fmt::color colour)
+{
+    fmt::print(status_output, "{}\n", format_colour(message, colour));
+}
+
+void write_verbose(string_view const message)
+{
+    if (verbose_messages_enabled)
+    {
+        write_colour(message, fmt::color::green);
+    }
+}
+
+void write_error(string_view const message)
+{
+    fmt::print(status_output, "{}\n", status_is_terminal ? fmt::format(fmt::fg(fmt::color::red), "{}", message) : string(message));
+}
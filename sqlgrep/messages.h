@@ -0,0 +1,19 @@
+#ifndef MESSAGES_H
+#define MESSAGES_H
+
+extern bool verbose_messages_enabled;
+
+// Progress and other messages go to stderr when matches are written in a machine-readable format.
+extern FILE * status_output;
+
+// Colours and progress redraws are only written to a terminal, not to a file or pipe.
+extern bool status_is_terminal;
+
+extern std::string const clear_eol;
+
+std::string format_colour(std::string_view message, fmt::color colour);
+void write_colour(std::string_view message, fmt::color colour);
+void write_verbose(std::string_view message);
+void write_error(std::string_view message);
+
+#endif //MESSAGES_H
@@ -1,14 +1,34 @@
 #ifndef PCH_H
 #define PCH_H
 
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cctype>
 #include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <fstream>
+#include <functional>
+#include <limits>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <numeric>
 #include <regex>
 #include <sstream>
 #include <string>
 #include <string_view>
 #include <optional>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
 
 #ifdef _WIN64
+#define NOMINMAX
 #include <Windows.h>
 #endif
 
@@ -18,5 +38,6 @@
 #include "fmt/color.h"
 #include "soci/soci.h"
 #include "soci/odbc/soci-odbc.h"
+#include "soci/sqlite3/soci-sqlite3.h"
 
 #endif //PCH_H
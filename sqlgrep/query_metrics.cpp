@@ -0,0 +1,66 @@
+#include "pch.h"
+#include "query_metrics.h"
+
+using namespace std;
+
+void scan_throughput::record(uint64_t const bytes, chrono::steady_clock::duration const duration)
+{
+    lock_guard<mutex> lock(mutex_);
+    bytes_ += bytes;
+    seconds_ += chrono::duration<double>(duration).count();
+    ++samples_;
+}
+
+optional<chrono::duration<double>> scan_throughput::estimate_duration(uint64_t const bytes)
+{
+    int const minimum_samples = 3;
+    lock_guard<mutex> lock(mutex_);
+    if (samples_ < minimum_samples || bytes_ == 0)
+        return {};
+    return chrono::duration<double>(bytes * seconds_ / bytes_);
+}
+
+void query_metrics::record_connect(size_t const target, chrono::duration<double> const duration)
+{
+    lock_guard<mutex> lock(mutex_);
+    ++targets_[target].connections;
+    targets_[target].connect_seconds += duration.count();
+}
+
+void query_metrics::record_query(size_t const target, query_timings const & timings, uint64_t const scanned_bytes, bool const succeeded)
+{
+    lock_guard<mutex> lock(mutex_);
+    auto& metrics = targets_[target];
+    ++metrics.queries;
+    if (!succeeded)
+        ++metrics.errors;
+    metrics.execute_seconds += timings.execute.count();
+    metrics.first_row_seconds += timings.first_row.count();
+    metrics.fetch_seconds += timings.fetch.count();
+    metrics.rows += timings.rows;
+    metrics.bytes += timings.bytes;
+    metrics.scanned_bytes += scanned_bytes;
+}
+
+void query_metrics::record_lock_timeout_retry(size_t const target)
+{
+    lock_guard<mutex> lock(mutex_);
+    ++targets_[target].lock_timeout_retries;
+}
+
+void query_metrics::record_hedge(size_t const target)
+{
+    lock_guard<mutex> lock(mutex_);
+    ++targets_[target].hedges;
+}
+
+vector<database_metrics> query_metrics::get_snapshot()
+{
+    lock_guard<mutex> lock(mutex_);
+    return targets_;
+}
+
+chrono::duration<double> query_metrics::get_elapsed() const
+{
+    return chrono::steady_clock::now() - started_at_;
+}
@@ -0,0 +1,62 @@
+#ifndef QUERY_METRICS_H
+#define QUERY_METRICS_H
+
+struct query_timings
+{
+    std::chrono::duration<double> execute{};
+    std::chrono::duration<double> first_row{};
+    std::chrono::duration<double> fetch{};
+    uint64_t rows = 0;
+    uint64_t bytes = 0;
+};
+
+// Measures how quickly completed searches scanned their tables, to estimate how long a search should take.
+class scan_throughput
+{
+public:
+    void record(uint64_t bytes, std::chrono::steady_clock::duration duration);
+    std::optional<std::chrono::duration<double>> estimate_duration(uint64_t bytes);
+
+private:
+    std::mutex mutex_;
+    uint64_t bytes_ = 0;
+    double seconds_ = 0;
+    int samples_ = 0;
+};
+
+struct database_metrics
+{
+    uint64_t queries = 0;
+    uint64_t errors = 0;
+    uint64_t connections = 0;
+    double connect_seconds = 0;
+    double execute_seconds = 0;
+    double first_row_seconds = 0;
+    double fetch_seconds = 0;
+    uint64_t rows = 0;
+    uint64_t bytes = 0;
+    uint64_t scanned_bytes = 0;
+    uint64_t lock_timeout_retries = 0;
+    uint64_t hedges = 0;
+};
+
+// Totals the time spent in each stage of the queries against each database, for finding where a slow search spends its time.
+class query_metrics
+{
+public:
+    explicit query_metrics(size_t const number_of_targets) : started_at_(std::chrono::steady_clock::now()), targets_(number_of_targets) {}
+
+    void record_connect(size_t target, std::chrono::duration<double> duration);
+    void record_query(size_t target, query_timings const & timings, uint64_t scanned_bytes, bool succeeded);
+    void record_lock_timeout_retry(size_t target);
+    void record_hedge(size_t target);
+    std::vector<database_metrics> get_snapshot();
+    std::chrono::duration<double> get_elapsed() const;
+
+private:
+    std::chrono::steady_clock::time_point const started_at_;
+    std::mutex mutex_;
+    std::vector<database_metrics> targets_;
+};
+
+#endif //QUERY_METRICS_H
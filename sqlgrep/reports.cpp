@@ -0,0 +1,181 @@
+#include "pch.h"
+#include "search_types.h"
+#include "blocking_queue.h"
+#include "work_queue.h"
+#include "attempt_registry.h"
+#include "budgets.h"
+#include "query_metrics.h"
+#include "search_job.h"
+#include "reports.h"
+#include "messages.h"
+
+using namespace std;
+
+void run_report::record(search_job const & job, search_result const & result)
+{
+    if (!result.budget_reason.empty())
+    {
+        ++columns_over_budget_;
+        return;
+    }
+    if (result.skipped)
+    {
+        ++skipped_columns_;
+        return;
+    }
+
+    auto const & column = result.column;
+    auto& table = tables_[get_location_prefix(job, column) + column.schema + "." + column.table];
+    table.seconds += result.search_time.count();
+    table.bytes = column.number_of_bytes;
+    ++table.columns;
+    if (result.server_statistics.has_value())
+    {
+        table.cpu_ms += result.server_statistics->cpu_ms;
+        table.logical_reads += result.server_statistics->logical_reads;
+        table.has_server_statistics = true;
+    }
+}
+
+void run_report::add_output_time(chrono::duration<double> const duration)
+{
+    output_time_ += duration;
+}
+
+template <typename IsMoreExpensive>
+void run_report::display_most_expensive(string_view const ranking, IsMoreExpensive const & is_more_expensive) const
+{
+    size_t const number_to_display = 20;
+    vector<pair<string, table_cost>> tables(begin(tables_), end(tables_));
+    auto const middle = begin(tables) + min(number_to_display, tables.size());
+    partial_sort(begin(tables), middle, end(tables), [&](auto const & a, auto const & b) { return is_more_expensive(a.second, b.second); });
+    tables.erase(middle, end(tables));
+    if (tables.empty())
+        return;
+
+    double const bytes_per_megabyte = 1024 * 1024;
+    write_colour(fmt::format("    Most expensive tables {}:", ranking), fmt::color::cyan);
+    write_colour(fmt::format("        {:>10} {:>10} {:>10} {:>10} {:>15}  {}", "Time (s)", "Size (MB)", "MB/s", "CPU (s)", "Logical reads", "Table"), fmt::color::cyan);
+    for (auto const & [name, table] : tables)
+    {
+        auto const scan_rate = table.seconds > 0 ? fmt::format("{:.1f}", table.bytes / bytes_per_megabyte * table.columns / table.seconds) : "-"s;
+        auto const cpu = table.has_server_statistics ? fmt::format("{:.1f}", table.cpu_ms / 1000.0) : "-"s;
+        auto const logical_reads = table.has_server_statistics ? to_string(table.logical_reads) : "-"s;
+        write_colour(fmt::format("        {:>10.1f} {:>10.1f} {:>10} {:>10} {:>15}  {}", table.seconds, table.bytes / bytes_per_megabyte, scan_rate, cpu, logical_reads, name), fmt::color::cyan);
+    }
+}
+
+void run_report::display(search_job & job, discovery_timings const & discovery, chrono::steady_clock::time_point const search_started_at) const
+{
+    auto const now = chrono::steady_clock::now();
+    chrono::duration<double> const total_time = now - started_at_;
+    chrono::duration<double> const discovery_time = search_started_at - started_at_;
+    chrono::duration<double> const search_time = now - search_started_at;
+    database_metrics search{};
+    for (auto const & metrics : job.metrics.get_snapshot())
+    {
+        search.connect_seconds += metrics.connect_seconds;
+        search.execute_seconds += metrics.execute_seconds;
+        search.fetch_seconds += metrics.fetch_seconds;
+    }
+
+    write_colour("Performance report:", fmt::color::cyan);
+    write_colour(fmt::format("    Total time: {:.1f} s", total_time.count()), fmt::color::cyan);
+    write_colour(fmt::format("    Catalog discovery: {:.1f} s (summed over {} database(s): connecting {:.1f} s, listing columns {:.1f} s, sizing tables {:.1f} s)",
+        discovery_time.count(), job.targets.size(), discovery.connect.count(), discovery.catalog.count(), discovery.sizing.count()), fmt::color::cyan);
+    write_colour(fmt::format("    Searching: {:.1f} s (summed over all connections: connecting {:.1f} s, executing {:.1f} s, fetching {:.1f} s)",
+        search_time.count(), search.connect_seconds, search.execute_seconds, search.fetch_seconds), fmt::color::cyan);
+    write_colour(fmt::format("    Writing output: {:.1f} s, while searching", output_time_.count()), fmt::color::cyan);
+    if (skipped_columns_ > 0)
+        write_colour(fmt::format("    Columns skipped because their tables stayed locked: {}", skipped_columns_), fmt::color::cyan);
+    if (columns_over_budget_ > 0)
+        write_colour(fmt::format("    Columns skipped to stay within the budget: {}", columns_over_budget_), fmt::color::cyan);
+
+    display_most_expensive("by search time", [](table_cost const & a, table_cost const & b) { return a.seconds > b.seconds; });
+    display_most_expensive("by size", [](table_cost const & a, table_cost const & b) { return a.bytes > b.bytes; });
+}
+
+void coverage_summary::record(search_job const & job, search_result const & result)
+{
+    auto const & column = result.column;
+    auto& table = tables_[get_location_prefix(job, column) + column.schema + "." + column.table];
+    ++table.columns;
+    total_bytes_ += column.number_of_bytes;
+    if (result.budget_reason.empty())
+    {
+        searched_bytes_ += column.number_of_bytes;
+        return;
+    }
+    ++table.skipped_columns;
+    table.reason = result.budget_reason;
+}
+
+void coverage_summary::display() const
+{
+    int columns = 0;
+    int skipped_columns = 0;
+    for (auto const & [name, table] : tables_)
+    {
+        columns += table.columns;
+        skipped_columns += table.skipped_columns;
+    }
+    auto const percent_searched = total_bytes_ == 0 ? 100.0 : searched_bytes_ * 100.0 / total_bytes_;
+    write_colour(fmt::format("Coverage: searched {} of {} columns, {:.1f}% of the table data.", columns - skipped_columns, columns, percent_searched), skipped_columns == 0 ? fmt::color::green : fmt::color::yellow);
+    if (skipped_columns == 0)
+        return;
+
+    for (auto const & [name, table] : tables_)
+    {
+        if (table.skipped_columns == table.columns)
+            write_colour(fmt::format("    Not searched: {} ({})", name, table.reason), fmt::color::yellow);
+        else if (table.skipped_columns > 0)
+            write_colour(fmt::format("    Partly searched: {}, {} of {} columns skipped ({})", name, table.skipped_columns, table.columns, table.reason), fmt::color::yellow);
+    }
+}
+
+void sample_summary::record(search_job const & job, search_result const & result)
+{
+    if (!result.sample.has_value())
+        return;
+    auto const & counts = result.sample.value();
+    if (counts.matching_rows == 0)
+    {
+        ++columns_without_matches_;
+        return;
+    }
+
+    auto const & column = result.column;
+    auto const name = get_location_prefix(job, column) + column.schema + "." + column.table + "." + column.column;
+    if (!counts.sampled)
+    {
+        estimates_.push_back({ name, static_cast<double>(counts.matching_rows), {}, "counted in the whole table" });
+        return;
+    }
+
+    double const z = 1.96;
+    double const n = static_cast<double>(counts.sampled_rows);
+    double const proportion = counts.matching_rows / n;
+    double const denominator = 1 + z * z / n;
+    double const centre = (proportion + z * z / (2 * n)) / denominator;
+    double const half_width = z * sqrt(proportion * (1 - proportion) / n + z * z / (4 * n * n)) / denominator;
+    double const rows = static_cast<double>(max(column.number_of_rows, counts.sampled_rows));
+    estimates_.push_back({ name, proportion * rows, pair<double, double>(max(0.0, centre - half_width) * rows, min(1.0, centre + half_width) * rows),
+        fmt::format("from {} of {} sampled rows", counts.matching_rows, counts.sampled_rows) });
+}
+
+void sample_summary::display()
+{
+    write_colour(fmt::format("These results are from a {}% sample of each table with more than {} rows, so other matches may have been missed.", percent_, maximum_rows_searched_in_full), fmt::color::yellow);
+    if (estimates_.empty())
+        return;
+
+    sort(begin(estimates_), end(estimates_), [](column_estimate const & a, column_estimate const & b) { return a.matching_rows > b.matching_rows; });
+    write_colour("Estimated matching rows (95% confidence interval):", fmt::color::yellow);
+    for (auto const & estimate : estimates_)
+    {
+        auto const interval = estimate.interval.has_value() ? fmt::format(" ({:.0f} to {:.0f})", estimate.interval->first, estimate.interval->second) : ""s;
+        write_colour(fmt::format("    {}: {:.0f}{}, {}", estimate.column, estimate.matching_rows, interval, estimate.basis), fmt::color::yellow);
+    }
+    if (columns_without_matches_ > 0)
+        write_colour(fmt::format("    {} other column(s) had no matches in the sample.", columns_without_matches_), fmt::color::yellow);
+}
@@ -0,0 +1,80 @@
+#ifndef REPORTS_H
+#define REPORTS_H
+
+// Totals where the time went in a run and which tables cost the most to search, for --report.
+class run_report
+{
+public:
+    explicit run_report(std::chrono::steady_clock::time_point const started_at) : started_at_(started_at) {}
+
+    void record(search_job const & job, search_result const & result);
+    void add_output_time(std::chrono::duration<double> duration);
+    void display(search_job & job, discovery_timings const & discovery, std::chrono::steady_clock::time_point search_started_at) const;
+
+private:
+    struct table_cost
+    {
+        double seconds = 0;
+        uint64_t bytes = 0;
+        int columns = 0;
+        uint64_t cpu_ms = 0;
+        uint64_t logical_reads = 0;
+        bool has_server_statistics = false;
+    };
+
+    template <typename IsMoreExpensive>
+    void display_most_expensive(std::string_view ranking, IsMoreExpensive const & is_more_expensive) const;
+
+    std::chrono::steady_clock::time_point const started_at_;
+    std::map<std::string, table_cost> tables_;
+    int skipped_columns_ = 0;
+    int columns_over_budget_ = 0;
+    std::chrono::duration<double> output_time_{};
+};
+
+// Tracks how much of the catalog was searched when a budget stops some columns from being searched.
+class coverage_summary
+{
+public:
+    void record(search_job const & job, search_result const & result);
+    void display() const;
+
+private:
+    struct table_coverage
+    {
+        int columns = 0;
+        int skipped_columns = 0;
+        std::string reason;
+    };
+
+    std::map<std::string, table_coverage> tables_;
+    uint64_t total_bytes_ = 0;
+    uint64_t searched_bytes_ = 0;
+};
+
+// Estimates how many rows of each column match from the rows sampled, with a 95% Wilson score interval.
+// Tables are sampled a page at a time, so rows are not sampled independently and the interval is
+// narrower than it should be when matching rows are clustered together.
+class sample_summary
+{
+public:
+    explicit sample_summary(double const percent) : percent_(percent) {}
+
+    void record(search_job const & job, search_result const & result);
+    void display();
+
+private:
+    struct column_estimate
+    {
+        std::string column;
+        double matching_rows;
+        std::optional<std::pair<double, double>> interval;
+        std::string basis;
+    };
+
+    double const percent_;
+    std::vector<column_estimate> estimates_;
+    int columns_without_matches_ = 0;
+};
+
+#endif //REPORTS_H
@@ -0,0 +1,223 @@
+#include "pch.h"
+#include "search_types.h"
+#include "blocking_queue.h"
+#include "results_database.h"
+#include "messages.h"
+#include "trace.h"
+
+using namespace std;
+using namespace soci;
+
+results_database::results_database(string const & path, vector<search_server> const & servers, vector<search_target> const & targets,
+    string_view const to_find, size_t const match_length, int const maximum_results_per_column, string const & database_pattern)
+    : servers_(servers), targets_(targets), match_length_(match_length), maximum_results_per_column_(maximum_results_per_column), db_(sqlite3, "db=" + path), results_(1024)
+{
+    db_ << "pragma journal_mode = wal";
+    db_ << "pragma synchronous = normal";
+    db_ << "create table if not exists runs(run_id integer primary key, started_at text not null, finished_at text, "
+        "search_text text not null, database_pattern text not null)";
+    db_ << "create table if not exists searched_columns(run_id integer not null references runs, server text not null, database_name text not null, "
+        "schema_name text not null, table_name text not null, column_name text not null, number_of_rows integer not null, number_of_bytes integer not null, "
+        "search_seconds real not null, matches integer not null, more_matches_available integer not null, deferrals integer not null, skipped integer not null)";
+    db_ << "create table if not exists matches(run_id integer not null references runs, server text not null, database_name text not null, "
+        "schema_name text not null, table_name text not null, column_name text not null, value text not null, truncated integer not null, "
+        "match_start integer, match_end integer, locator text)";
+    int has_locator_column = 0;
+    db_ << "select count(*) from pragma_table_info('matches') where name = 'locator'", into(has_locator_column);
+    if (has_locator_column == 0)
+        db_ << "alter table matches add column locator text";
+
+    string const search_text(to_find);
+    db_ << "insert into runs(started_at, search_text, database_pattern) values(datetime('now'), :search_text, :database_pattern)", use(search_text), use(database_pattern);
+    db_ << "select last_insert_rowid()", into(run_id_);
+    writer_ = thread([this] { run(); });
+}
+
+results_database::~results_database()
+{
+    stop();
+}
+
+void results_database::add(search_result const & result)
+{
+    results_.push(result);
+}
+
+void results_database::finish()
+{
+    stop();
+    if (error_)
+        rethrow_exception(error_);
+
+    write_verbose("Indexing the results database.");
+    db_ << "create index if not exists matches_by_location on matches(run_id, server, database_name, schema_name, table_name, column_name)";
+    db_ << "create index if not exists searched_columns_by_location on searched_columns(run_id, server, database_name, schema_name, table_name, column_name)";
+    db_ << "update runs set finished_at = datetime('now') where run_id = :run_id", use(run_id_);
+}
+
+void results_database::location_rows::add(long long const run_id, string const & server, string const & database, column_details const & column)
+{
+    run_ids.push_back(run_id);
+    servers.push_back(server);
+    databases.push_back(database);
+    schemas.push_back(column.schema);
+    tables.push_back(column.table);
+    columns.push_back(column.column);
+}
+
+void results_database::location_rows::clear()
+{
+    for (auto names : { &servers, &databases, &schemas, &tables, &columns })
+        names->clear();
+    run_ids.clear();
+}
+
+void results_database::stop()
+{
+    if (writer_.joinable())
+    {
+        results_.push({});
+        writer_.join();
+    }
+}
+
+void results_database::run()
+{
+    name_trace_thread("results database");
+    location_rows column_locations;
+    vector<long long> rows, bytes, matches, more_matches_available, deferrals, skipped;
+    vector<double> seconds;
+    statement insert_columns = (db_.prepare <<
+        "insert into searched_columns(run_id, server, database_name, schema_name, table_name, column_name, number_of_rows, number_of_bytes, "
+        "search_seconds, matches, more_matches_available, deferrals, skipped) "
+        "values(:run_id, :server, :database_name, :schema_name, :table_name, :column_name, :number_of_rows, :number_of_bytes, "
+        ":search_seconds, :matches, :more_matches_available, :deferrals, :skipped)",
+        use(column_locations.run_ids), use(column_locations.servers), use(column_locations.databases), use(column_locations.schemas),
+        use(column_locations.tables), use(column_locations.columns), use(rows), use(bytes), use(seconds), use(matches),
+        use(more_matches_available), use(deferrals), use(skipped));
+
+    location_rows match_locations;
+    vector<string> values;
+    vector<long long> truncated, match_starts, match_ends;
+    vector<indicator> match_start_indicators, match_end_indicators;
+    vector<string> locators;
+    vector<indicator> locator_indicators;
+    statement insert_matches = (db_.prepare <<
+        "insert into matches(run_id, server, database_name, schema_name, table_name, column_name, value, truncated, match_start, match_end, locator) "
+        "values(:run_id, :server, :database_name, :schema_name, :table_name, :column_name, :value, :truncated, :match_start, :match_end, :locator)",
+        use(match_locations.run_ids), use(match_locations.servers), use(match_locations.databases), use(match_locations.schemas),
+        use(match_locations.tables), use(match_locations.columns), use(values), use(truncated),
+        use(match_starts, match_start_indicators), use(match_ends, match_end_indicators), use(locators, locator_indicators));
+
+    auto const write_batch = [&] {
+        if (column_locations.run_ids.empty() && match_locations.run_ids.empty())
+            return;
+
+        trace_span span("save results", "output");
+        transaction batch(db_);
+        if (!column_locations.run_ids.empty())
+            insert_columns.execute(true);
+        if (!match_locations.run_ids.empty())
+            insert_matches.execute(true);
+        batch.commit();
+
+        column_locations.clear();
+        for (auto numbers : { &rows, &bytes, &matches, &more_matches_available, &deferrals, &skipped })
+            numbers->clear();
+        seconds.clear();
+        match_locations.clear();
+        for (auto numbers : { &truncated, &match_starts, &match_ends })
+            numbers->clear();
+        values.clear();
+        match_start_indicators.clear();
+        match_end_indicators.clear();
+        locators.clear();
+        locator_indicators.clear();
+    };
+
+    unordered_map<size_t, long long> streamed_matches;
+    while (auto result = results_.pop())
+    {
+        if (error_)
+            continue;
+
+        try
+        {
+            auto const & column = result->column;
+            auto const & target = targets_[column.target];
+            auto const & server = servers_[target.server].name;
+            auto const shown = min(result->matches.size(), static_cast<size_t>(maximum_results_per_column_));
+            if (result->partial)
+            {
+                streamed_matches[result->column_index] += static_cast<long long>(shown);
+            }
+            else
+            {
+                column_locations.add(run_id_, server, target.database, column);
+                rows.push_back(static_cast<long long>(column.number_of_rows));
+                bytes.push_back(static_cast<long long>(column.number_of_bytes));
+                seconds.push_back(result->search_time.count());
+                matches.push_back(static_cast<long long>(shown) + streamed_matches[result->column_index]);
+                more_matches_available.push_back(result->matches.size() > shown);
+                deferrals.push_back(result->deferrals);
+                skipped.push_back(result->skipped);
+                streamed_matches.erase(result->column_index);
+            }
+
+            for (size_t i = 0; i != shown; ++i)
+            {
+                auto const & found = result->matches[i];
+                match_locations.add(run_id_, server, target.database, column);
+                values.push_back(found.value);
+                truncated.push_back(found.truncated);
+                match_starts.push_back(static_cast<long long>(found.offset.value_or(0)));
+                match_ends.push_back(static_cast<long long>(found.offset.value_or(0) + match_length_));
+                match_start_indicators.push_back(found.offset.has_value() ? i_ok : i_null);
+                match_end_indicators.push_back(found.offset.has_value() ? i_ok : i_null);
+                locators.push_back(found.locator.value_or(""s));
+                locator_indicators.push_back(found.locator.has_value() ? i_ok : i_null);
+            }
+
+            if (column_locations.run_ids.size() >= maximum_batch_columns || match_locations.run_ids.size() >= maximum_batch_matches)
+                write_batch();
+        }
+        catch (...)
+        {
+            error_ = current_exception();
+        }
+    }
+
+    try
+    {
+        if (!error_)
+            write_batch();
+    }
+    catch (...)
+    {
+        error_ = current_exception();
+    }
+}
+
+map<string, int> get_previous_matches(string const & path, string const & to_find)
+{
+    map<string, int> previous_matches;
+    if (!ifstream(path))
+        return previous_matches;
+
+    session db(sqlite3, "db=" + path);
+    int has_results = 0;
+    db << "select count(*) from sqlite_master where type = 'table' and name in ('runs', 'searched_columns')", into(has_results);
+    if (has_results != 2)
+        return previous_matches;
+
+    rowset<row> const matched = db.prepare <<
+        "select distinct c.server, c.database_name, c.schema_name, c.table_name, c.column_name, r.search_text "
+        "from searched_columns c join runs r on r.run_id = c.run_id where c.matches > 0";
+    for (auto const & r : matched)
+    {
+        auto const key = r.get<string>(0) + '\t' + r.get<string>(1) + '\t' + r.get<string>(2) + '\t' + r.get<string>(3) + '\t' + r.get<string>(4);
+        auto& score = previous_matches[key];
+        score = max(score, r.get<string>(5) == to_find ? 2 : 1);
+    }
+    return previous_matches;
+}
@@ -0,0 +1,54 @@
+#ifndef RESULTS_DATABASE_H
+#define RESULTS_DATABASE_H
+
+// Records the matches and per-column statistics of a run in a SQLite database, so that they can be
+// queried afterwards. Results are written by a background thread in large transactions.
+class results_database
+{
+public:
+    results_database(std::string const & path, std::vector<search_server> const & servers, std::vector<search_target> const & targets,
+        std::string_view to_find, size_t match_length, int maximum_results_per_column, std::string const & database_pattern);
+    ~results_database();
+
+    results_database(results_database const &) = delete;
+    results_database & operator=(results_database const &) = delete;
+
+    void add(search_result const & result);
+    void finish();
+
+private:
+    // Each row is held in columns, as SOCI inserts a whole batch of rows from vectors in one go.
+    struct location_rows
+    {
+        std::vector<long long> run_ids;
+        std::vector<std::string> servers;
+        std::vector<std::string> databases;
+        std::vector<std::string> schemas;
+        std::vector<std::string> tables;
+        std::vector<std::string> columns;
+
+        void add(long long run_id, std::string const & server, std::string const & database, column_details const & column);
+        void clear();
+    };
+
+    void stop();
+    void run();
+
+    static size_t const maximum_batch_columns = 10'000;
+    static size_t const maximum_batch_matches = 100'000;
+    std::vector<search_server> const & servers_;
+    std::vector<search_target> const & targets_;
+    size_t const match_length_;
+    int const maximum_results_per_column_;
+    soci::session db_;
+    long long run_id_ = 0;
+    blocking_queue<std::optional<search_result>> results_;
+    std::exception_ptr error_;
+    std::thread writer_;
+};
+
+// Reads which columns held matches in the runs already recorded in a results database, scoring those that
+// matched the same text higher than those that matched something else.
+std::map<std::string, int> get_previous_matches(std::string const & path, std::string const & to_find);
+
+#endif //RESULTS_DATABASE_H
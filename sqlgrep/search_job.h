@@ -0,0 +1,56 @@
+#ifndef SEARCH_JOB_H
+#define SEARCH_JOB_H
+
+enum class blocked_table_fallback
+{
+    none,
+    readpast,
+    read_uncommitted
+};
+
+struct blocking_settings
+{
+    int lock_timeout_ms;
+    int maximum_deferrals;
+    blocked_table_fallback fallback;
+};
+
+// Tables with no more rows than this are searched in full when sampling, since a sample of a small table
+// would be too small to tell anything from and searching all of it is cheap anyway.
+uint64_t const maximum_rows_searched_in_full = 10000;
+
+struct search_job
+{
+    std::vector<search_server> const & servers;
+    std::vector<search_endpoint> const & endpoints;
+    std::vector<search_target> const & targets;
+    bool const qualify_with_server;
+    bool const qualify_with_database;
+    std::vector<column_details> const & columns;
+    std::string_view const to_find;
+    // The search text as it appears in fetched values, whose positions are reported as match offsets.
+    std::string const match_text;
+    bool const fetch_utf8;
+    int const maximum_results_per_column;
+    bool const stream_all;
+    bool const collect_server_statistics;
+    double const sample_percent;
+    blocking_settings const blocking;
+    read_budget budget;
+    cost_budget cost;
+    work_queue queue;
+    attempt_registry attempts;
+    scan_throughput throughput;
+    query_metrics metrics;
+    blocking_queue<search_result> results;
+};
+
+// Names the server and database of a column when there is more than one of them to tell apart.
+inline std::string get_location_prefix(search_job const & job, column_details const & column)
+{
+    auto const & target = job.targets[column.target];
+    auto const server_prefix = job.qualify_with_server ? job.servers[target.server].name + ":" : std::string();
+    return server_prefix + (job.qualify_with_database ? target.database + "." : std::string());
+}
+
+#endif //SEARCH_JOB_H
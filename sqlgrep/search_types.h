@@ -0,0 +1,92 @@
+#ifndef SEARCH_TYPES_H
+#define SEARCH_TYPES_H
+
+struct column_details
+{
+    std::string schema;
+    std::string table;
+    std::string column;
+    uint64_t number_of_rows;
+    uint64_t number_of_bytes;
+    std::string data_space;
+    size_t target;
+    std::string locator;
+    std::string data_type;
+    int maximum_length;
+};
+
+struct search_server
+{
+    std::string name;
+    std::vector<std::string> endpoints;
+};
+
+struct search_endpoint
+{
+    size_t server;
+    std::string name;
+    std::string connection_string;
+};
+
+struct search_target
+{
+    size_t server;
+    std::string database;
+    std::string search_database;
+    std::string isolation_level_command;
+};
+
+struct found_match
+{
+    std::string value;
+    bool truncated;
+    std::optional<size_t> offset;
+    std::optional<std::string> locator;
+};
+
+struct match_details
+{
+    column_details column;
+    bool more_matches_available;
+    std::vector<found_match> matches;
+};
+
+struct session_statistics
+{
+    uint64_t cpu_ms;
+    uint64_t logical_reads;
+};
+
+struct sample_counts
+{
+    uint64_t sampled_rows;
+    uint64_t matching_rows;
+    bool sampled;
+};
+
+struct search_result
+{
+    size_t column_index;
+    column_details column;
+    std::vector<found_match> matches;
+    std::exception_ptr error;
+    int deferrals;
+    std::string blocked_reason;
+    bool searched_with_fallback;
+    bool skipped;
+    std::chrono::duration<double> search_time;
+    bool partial;
+    std::optional<session_statistics> server_statistics;
+    std::string budget_reason;
+    std::optional<sample_counts> sample;
+};
+
+// Time spent discovering the catalog, summed over the databases prepared concurrently.
+struct discovery_timings
+{
+    std::chrono::duration<double> connect{};
+    std::chrono::duration<double> catalog{};
+    std::chrono::duration<double> sizing{};
+};
+
+#endif //SEARCH_TYPES_H
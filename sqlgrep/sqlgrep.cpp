@@ -1,204 +1,2016 @@
 #include "pch.h"
 #include "sqlgrep.h"
+#include "search_types.h"
+#include "blocking_queue.h"
+#include "work_queue.h"
+#include "attempt_registry.h"
+#include "budgets.h"
+#include "query_metrics.h"
+#include "search_job.h"
+#include "catalog_cache.h"
+#include "cost_model.h"
+#include "file_formats.h"
+#include "match_writers.h"
+#include "messages.h"
+#include "reports.h"
+#include "results_database.h"
+#include "trace.h"
 
 using namespace std;
 using namespace soci;
 
-struct column_details
+struct throttle_settings
 {
-    string schema;
-    string table;
-    string column;
-    uint64_t number_of_rows;
+    int minimum_concurrency;
+    int maximum_concurrency;
+    bool adaptive;
+    double read_budget_megabytes_per_second;
+    int maximum_scans_per_data_space;
+    double time_budget_seconds;
+    double io_budget_megabytes;
 };
 
-struct match_details
+struct connection_settings
 {
-    column_details column;
-    bool more_matches_available;
-    vector<string> matches;
+    string driver;
+    string credential;
+    bool read_only_intent;
+};
+
+struct snapshot_settings
+{
+    bool enabled;
+    optional<string> name;
+};
+
+struct output_settings
+{
+    bool ordered;
+    int reorder_memory_megabytes;
+    output_format format;
+    optional<string> results_database_path;
+    bool stream_all;
+    bool locate_rows;
+    bool report;
+    bool plan_only;
+    bool likely_first;
+    double sample_percent;
+    optional<string> stats_path;
+    optional<string> prometheus_metrics_path;
+    optional<string> json_metrics_path;
+    int metrics_interval_seconds;
+};
+
+class database_query_logger : public logger_impl
+{
+public:
+    void start_query(std::string const & query) override
+    {
+        write_verbose("Query: "s + query);
+    }
+
+private:
+    logger_impl* do_clone() const override
+    {
+        return new database_query_logger;   // `new` is required by SOCI
+    }
+};
+
+// Tracks how much of the search is done, weighting each column by its expected cost, such as the size of
+// its table, so that a table of large documents counts for more than a narrow lookup table with as many
+// rows. Throughput is smoothed so that the estimated time remaining does not swing with every table.
+class progress_estimator
+{
+public:
+    progress_estimator(uint64_t const total_weight, uint64_t const total_bytes, uint64_t const total_rows)
+        : total_weight_(total_weight), total_bytes_(total_bytes), total_rows_(total_rows), start_time_(chrono::steady_clock::now()), last_sample_time_(start_time_)
+    {
+    }
+
+    static uint64_t get_weight(uint64_t const bytes)
+    {
+        // Even an empty table takes a query to search.
+        uint64_t const page_size = 8192;
+        return max(bytes, page_size);
+    }
+
+    void record(uint64_t const weight, uint64_t const bytes, uint64_t const rows)
+    {
+        completed_weight_ += weight;
+        completed_bytes_ += bytes;
+        completed_rows_ += rows;
+
+        auto const now = chrono::steady_clock::now();
+        chrono::duration<double> const elapsed = now - last_sample_time_;
+        if (elapsed < chrono::seconds(1))
+            return;
+
+        double const smoothing = 0.3;
+        auto const smooth = [smoothing, &elapsed](double const average, uint64_t const completed, uint64_t const sampled) {
+            return smoothing * (completed - sampled) / elapsed.count() + (1 - smoothing) * average;
+        };
+        if (weight_per_second_.has_value())
+        {
+            weight_per_second_ = smooth(weight_per_second_.value(), completed_weight_, sampled_weight_);
+            bytes_per_second_ = smooth(bytes_per_second_, completed_bytes_, sampled_bytes_);
+            rows_per_second_ = smooth(rows_per_second_, completed_rows_, sampled_rows_);
+        }
+        else
+        {
+            weight_per_second_ = completed_weight_ / elapsed.count();
+            bytes_per_second_ = completed_bytes_ / elapsed.count();
+            rows_per_second_ = completed_rows_ / elapsed.count();
+        }
+        last_sample_time_ = now;
+        sampled_weight_ = completed_weight_;
+        sampled_bytes_ = completed_bytes_;
+        sampled_rows_ = completed_rows_;
+    }
+
+    string format() const
+    {
+        auto const percent_complete = total_weight_ == 0 ? 100 : min<uint64_t>(completed_weight_ * 100 / total_weight_, 100);
+        auto progress = fmt::format("{}{}% complete", clear_eol, percent_complete);
+        if (weight_per_second_.has_value() && weight_per_second_.value() > 0)
+        {
+            auto const remaining_weight = total_weight_ > completed_weight_ ? total_weight_ - completed_weight_ : 0;
+            auto const remaining_seconds = static_cast<uint64_t>(remaining_weight / weight_per_second_.value());
+            progress += fmt::format(" ({:.1f} MB/s, {:.0f} rows/s, {} seconds remaining)", bytes_per_second_ / bytes_per_megabyte, rows_per_second_, remaining_seconds);
+        }
+        return progress + "...\r";
+    }
+
+    string describe() const
+    {
+        chrono::duration<double> const elapsed = chrono::steady_clock::now() - start_time_;
+        return fmt::format("Completed {} of {} rows ({:.1f} of {:.1f} MB) in {:.0f} seconds.", completed_rows_, total_rows_, completed_bytes_ / bytes_per_megabyte, total_bytes_ / bytes_per_megabyte, elapsed.count());
+    }
+
+private:
+    static constexpr double bytes_per_megabyte = 1024 * 1024;
+    uint64_t const total_weight_;
+    uint64_t const total_bytes_;
+    uint64_t const total_rows_;
+    chrono::steady_clock::time_point const start_time_;
+    uint64_t completed_weight_ = 0;
+    uint64_t completed_bytes_ = 0;
+    uint64_t completed_rows_ = 0;
+    chrono::steady_clock::time_point last_sample_time_;
+    uint64_t sampled_weight_ = 0;
+    uint64_t sampled_bytes_ = 0;
+    uint64_t sampled_rows_ = 0;
+    optional<double> weight_per_second_;
+    double bytes_per_second_ = 0;
+    double rows_per_second_ = 0;
+};
+
+auto enquote(string_view const val)
+{
+    return "\""s + string(val) + "\"";
+}
+
+auto table_key(string_view const schema, string_view const table)
+{
+    return enquote(schema) + "." + enquote(table);
+}
+
+auto build_connection_string(connection_settings const & connection, string_view const server, string_view const database)
+{
+    auto const application_intent = connection.read_only_intent ? "ApplicationIntent=ReadOnly;"s : ""s;
+    return "Driver={" + connection.driver + "};Server=" + string(server) + ";Database=" + string(database) + ";Encrypt=Optional;App=sqlgrep;" + application_intent + connection.credential;
+}
+
+auto open_session(string const & connection_string, int const lock_timeout_ms)
+{
+    connection_parameters parameters(odbc, connection_string);
+    parameters.set_option(odbc_option_driver_complete, to_string(SQL_DRIVER_NOPROMPT));
+    auto sql = make_unique<session>(parameters);
+    sql->set_logger(new database_query_logger);  // `new` is required by SOCI
+    if (lock_timeout_ms >= 0)
+        *sql << "set lock_timeout " << lock_timeout_ms;
+    return sql;
+}
+
+auto is_lock_timeout(odbc_soci_error const & e)
+{
+    int const lock_request_timeout_exceeded = 1222;
+    return e.native_error_code() == lock_request_timeout_exceeded;
+}
+
+auto get_isolation_level_command(session & sql)
+{
+    string isolation_level;
+    sql << "select case (select snapshot_isolation_state_desc from sys.databases where name = db_name()) when 'on' then 'snapshot' else 'read committed' end", into(isolation_level);
+    string const isolation_level_command = "set transaction isolation level "s + isolation_level;
+    return isolation_level_command;
+}
+
+auto escape_string_literal(string_view const val)
+{
+    string result;
+    for (auto const c : val)
+    {
+        result += c;
+        if (c == '\'')
+            result += c;
+    }
+    return result;
+}
+
+// A database snapshot gives every search session the same consistent, read-only image of the database.
+// Snapshots created by sqlgrep are dropped again once the search has finished.
+class database_snapshot
+{
+public:
+    database_snapshot(string name, string source_connection_string, bool owned)
+        : name_(move(name)), source_connection_string_(move(source_connection_string)), owned_(owned)
+    {
+    }
+
+    database_snapshot(database_snapshot && other) noexcept
+        : name_(move(other.name_)), source_connection_string_(move(other.source_connection_string_)), owned_(other.owned_)
+    {
+        other.owned_ = false;
+    }
+
+    ~database_snapshot()
+    {
+        if (!owned_)
+            return;
+
+        try
+        {
+            auto sql = open_session(source_connection_string_, -1);
+            *sql << "drop database " << enquote(name_);
+            write_verbose("Dropped database snapshot "s + name_ + ".");
+        }
+        catch (exception & e)
+        {
+            write_error("Unable to drop database snapshot "s + name_ + ": " + e.what());
+        }
+    }
+
+    database_snapshot(database_snapshot const &) = delete;
+    database_snapshot & operator=(database_snapshot const &) = delete;
+    database_snapshot & operator=(database_snapshot &&) = delete;
+
+    string const & get_name() const { return name_; }
+
+private:
+    string name_;
+    string source_connection_string_;
+    bool owned_;
 };
 
-bool verbose_messages_enabled = false;
+auto create_database_snapshot(session & sql, string_view const database, string const & snapshot_name)
+{
+    rowset<row> files = sql.prepare << "select name, physical_name from sys.database_files where type = 0";
+
+    stringstream command;
+    command << "create database " << enquote(snapshot_name) << " on ";
+    string separator;
+    for (auto& r : files)
+    {
+        command << separator << "(name = " << enquote(r.get<string>(0)) << ", filename = '" << escape_string_literal(r.get<string>(1) + "." + snapshot_name + ".ss") << "')";
+        separator = ", ";
+    }
+    command << " as snapshot of " << enquote(database);
+    sql << command.str();
+}
+
+auto open_database_snapshot(session & sql, string const & source_connection_string, string_view const database, snapshot_settings const & settings) -> optional<database_snapshot>
+{
+    auto const seconds_since_epoch = chrono::duration_cast<chrono::seconds>(chrono::system_clock::now().time_since_epoch()).count();
+    auto const name = settings.name.value_or(string(database) + "_sqlgrep_" + to_string(seconds_since_epoch));
+
+    int existing;
+    sql << "select count(*) from sys.databases where name = :name and source_database_id = db_id()", use(name), into(existing);
+    if (existing > 0)
+    {
+        write_verbose("Using existing database snapshot "s + name + ".");
+        return database_snapshot(name, source_connection_string, false);
+    }
+
+    try
+    {
+        fmt::print(status_output, "Creating database snapshot {}...\n", name);
+        create_database_snapshot(sql, database, name);
+        return database_snapshot(name, source_connection_string, true);
+    }
+    catch (soci_error & e)
+    {
+        write_error("Unable to create a database snapshot, so searching the live database instead: "s + e.what());
+        return {};
+    }
+}
+
+auto get_number_of_rows(session & sql, string_view const isolation_level_command, string_view const schema, string_view const table, string_view const column, uint64_t const estimated_rows, unordered_map<string, uint64_t> & cache)
+{
+    uint64_t count;
+    stringstream query;
+    query << isolation_level_command << ";select count(*) from " << enquote(schema) << "." << enquote(table);
+    auto const query_str = query.str();
+
+    auto const cached = cache.find(query_str);
+    if (cached != cache.end())
+        return cached->second;
+
+    try
+    {
+        sql << query_str, into(count);
+    }
+    catch (odbc_soci_error & e)
+    {
+        if (!is_lock_timeout(e))
+            throw;
+        write_verbose("Table "s + string(schema) + "." + string(table) + " is locked, so using the estimated row count.");
+        count = estimated_rows;
+    }
+
+    cache[query_str] = count;
+
+    return count;
+}
+
+struct table_size
+{
+    uint64_t estimated_rows;
+    uint64_t bytes;
+    string data_space;
+};
+
+auto query_table_sizes(session & sql, bool const include_volumes)
+{
+    // Tables are grouped by the volume that holds their data when the server lets us see it, otherwise by filegroup (or partition scheme).
+    string const volume = include_volumes
+        ? "(select top 1 v.volume_mount_point from sys.indexes i "
+          "join sys.database_files f on f.data_space_id = i.data_space_id "
+          "cross apply sys.dm_os_volume_stats(db_id(), f.file_id) v "
+          "where i.object_id = t.object_id and i.index_id in (0, 1) order by f.file_id)"
+        : "null";
+    rowset<row> data = sql.prepare <<
+        "select s.name SchemaName, t.name TableName, "
+        "isnull((select sum(p.rows) from sys.partitions p where p.object_id = t.object_id and p.index_id in (0, 1)), 0) EstimatedRows, "
+        "isnull((select cast(sum(a.used_pages) as bigint) from sys.partitions p "
+        "join sys.allocation_units a on a.container_id = case a.type when 2 then p.partition_id else p.hobt_id end "
+        "where p.object_id = t.object_id and p.index_id in (0, 1)), 0) * 8192 UsedBytes, "
+        "isnull(" + volume + ", db_name() + '.' + isnull((select d.name from sys.indexes i join sys.data_spaces d on d.data_space_id = i.data_space_id "
+        "where i.object_id = t.object_id and i.index_id in (0, 1)), '')) DataSpace "
+        "from sys.tables t "
+        "join sys.schemas s on s.schema_id = t.schema_id";
+
+    unordered_map<string, table_size> sizes;
+    for (auto& r : data)
+    {
+        sizes[table_key(r.get<string>(0), r.get<string>(1))] = { static_cast<uint64_t>(r.get<long long>(2)), static_cast<uint64_t>(r.get<long long>(3)), r.get<string>(4) };
+    }
+    return sizes;
+}
+
+auto get_table_sizes(session & sql)
+{
+    try
+    {
+        return query_table_sizes(sql, true);
+    }
+    catch (soci_error & e)
+    {
+        write_verbose("Unable to find the volumes that hold each table, so using filegroups instead: "s + e.what());
+        return query_table_sizes(sql, false);
+    }
+}
+
+string const string_columns_query =
+    "from INFORMATION_SCHEMA.COLUMNS c "
+    "where DATA_TYPE in('char', 'varchar', 'nchar', 'nvarchar') and "
+    "(select TABLE_TYPE from INFORMATION_SCHEMA.TABLES t where t.TABLE_SCHEMA = c.TABLE_SCHEMA and t.TABLE_NAME = c.TABLE_NAME) = 'BASE TABLE' ";
+
+auto get_schema_fingerprint(session & sql)
+{
+    uint64_t number_of_columns;
+    long long checksum;
+    sql << "select count(*), isnull(checksum_agg(checksum(TABLE_SCHEMA, TABLE_NAME, COLUMN_NAME, DATA_TYPE, CHARACTER_MAXIMUM_LENGTH)), 0) " + string_columns_query, into(number_of_columns), into(checksum);
+    return to_string(number_of_columns) + ":" + to_string(checksum);
+}
+
+auto resize_string_columns(session & sql, vector<column_details> columns)
+{
+    auto const table_sizes = get_table_sizes(sql);
+    for (auto& column : columns)
+    {
+        auto const found = table_sizes.find(table_key(column.schema, column.table));
+        auto const size = found == table_sizes.end() ? table_size{ 0, 0, {} } : found->second;
+        column.number_of_rows = size.estimated_rows;
+        column.number_of_bytes = size.bytes;
+        column.data_space = size.data_space;
+    }
+    return columns;
+}
+
+// Exact row counts scan every table, so they can be left out in favour of the estimates in sys.partitions.
+auto get_all_string_columns(session & sql, string_view const isolation_level_command, bool const count_rows, chrono::duration<double> & sizing_time)
+{
+    rowset<row> data = sql.prepare <<
+        "select TABLE_SCHEMA SchemaName, TABLE_NAME TableName, COLUMN_NAME ColumnName, DATA_TYPE DataType, CHARACTER_MAXIMUM_LENGTH MaximumLength " + string_columns_query +
+        "order by TABLE_SCHEMA, TABLE_NAME, COLUMN_NAME";
+
+    vector<column_details> details;
+    for (auto& r : data)
+    {
+        // The maximum length is -1 for (n)varchar(max).
+        auto const maximum_length = r.get<int>(4);
+        auto const data_type = r.get<string>(3) + "(" + (maximum_length < 0 ? "max"s : to_string(maximum_length)) + ")";
+        column_details column{ r.get<string>(0), r.get<string>(1), r.get<string>(2), 0, 0, {}, 0, {}, data_type, maximum_length };
+        details.push_back(column);
+    }
+
+    auto const sizing_started_at = chrono::steady_clock::now();
+    auto const table_sizes = get_table_sizes(sql);
+    unordered_map<string, uint64_t> cache;
+    for (auto& column : details)
+    {
+        auto const found = table_sizes.find(table_key(column.schema, column.table));
+        auto const size = found == table_sizes.end() ? table_size{ 0, 0, {} } : found->second;
+        column.number_of_rows = count_rows ? get_number_of_rows(sql, isolation_level_command, column.schema, column.table, column.column, size.estimated_rows, cache) : size.estimated_rows;
+        column.number_of_bytes = size.bytes;
+        column.data_space = size.data_space;
+        write_verbose("Number of rows in "s + column.schema + "." + column.table + "." + column.column + ": " + to_string(column.number_of_rows) + " (" + to_string(column.number_of_bytes) + " bytes on " + column.data_space + ").");
+    }
+    sizing_time += chrono::steady_clock::now() - sizing_started_at;
+
+    return details;
+}
+
+// Builds an expression that identifies a row by the values of the given key columns.
+auto get_key_locator(vector<pair<string, string>> const & key_columns)
+{
+    string locator = "concat(";
+    for (auto const & [name, type] : key_columns)
+    {
+        string value = enquote(name);
+        if (type == "binary" || type == "varbinary" || type == "timestamp")
+            value = "convert(varchar(max), " + value + ", 1)";
+        else if (type == "date" || type == "time" || type == "datetime" || type == "datetime2" || type == "datetimeoffset" || type == "smalldatetime")
+            value = "convert(varchar(40), " + value + ", 126)";
+        locator += (locator.size() > 7 ? ", N', " : "N'") + escape_string_literal(name) + "=', " + value;
+    }
+    return locator + ")";
+}
+
+// Finds how to identify the rows of each table: by its primary key, otherwise by its narrowest unique
+// index, otherwise by physical location for tables stored as rows.
+auto get_row_locators(session & sql)
+{
+    rowset<row> keys = sql.prepare <<
+        "with UniqueKeys as ("
+        "select i.object_id, i.index_id, row_number() over (partition by i.object_id order by i.is_primary_key desc, "
+        "(select count(*) from sys.index_columns ic where ic.object_id = i.object_id and ic.index_id = i.index_id and ic.key_ordinal > 0), i.index_id) Preference "
+        "from sys.indexes i where (i.is_primary_key = 1 or i.is_unique = 1) and i.has_filter = 0 and i.is_disabled = 0 and i.type in (1, 2)) "
+        "select s.name SchemaName, t.name TableName, c.name ColumnName, type_name(c.system_type_id) TypeName "
+        "from sys.tables t "
+        "join sys.schemas s on s.schema_id = t.schema_id "
+        "join UniqueKeys k on k.object_id = t.object_id and k.Preference = 1 "
+        "join sys.index_columns ic on ic.object_id = k.object_id and ic.index_id = k.index_id and ic.key_ordinal > 0 "
+        "join sys.columns c on c.object_id = ic.object_id and c.column_id = ic.column_id "
+        "order by s.name, t.name, ic.key_ordinal";
+
+    map<string, vector<pair<string, string>>> key_columns;
+    for (auto& r : keys)
+        key_columns[table_key(r.get<string>(0), r.get<string>(1))].emplace_back(r.get<string>(2), r.get<string>(3));
+
+    unordered_map<string, string> locators;
+    for (auto const & [table, columns] : key_columns)
+        locators[table] = get_key_locator(columns);
+
+    rowset<row> row_stores = sql.prepare <<
+        "select s.name SchemaName, t.name TableName from sys.tables t "
+        "join sys.schemas s on s.schema_id = t.schema_id "
+        "where exists (select 1 from sys.indexes i where i.object_id = t.object_id and i.index_id in (0, 1) and i.type in (0, 1))";
+    for (auto& r : row_stores)
+        locators.emplace(table_key(r.get<string>(0), r.get<string>(1)), "sys.fn_PhysLocFormatter(%%physloc%%)");
+    return locators;
+}
+
+auto add_row_locators(session & sql, vector<column_details> & columns)
+{
+    auto const locators = get_row_locators(sql);
+    for (auto& column : columns)
+    {
+        auto const found = locators.find(table_key(column.schema, column.table));
+        column.locator = found == locators.end() ? ""s : found->second;
+    }
+}
+
+auto escape_search_text(string_view to_find)
+{
+    regex const r("([\\\\%_[])");
+    string result;
+    regex_replace(back_inserter(result), begin(to_find), end(to_find), r, "\\$1");
+    return result;
+}
+
+auto get_table_hint(blocked_table_fallback const fallback)
+{
+    switch (fallback)
+    {
+    case blocked_table_fallback::readpast:
+        return " with (readpast)"s;
+    case blocked_table_fallback::read_uncommitted:
+        return " with (nolock)"s;
+    default:
+        return ""s;
+    }
+}
+
+// The sample is repeatable so that counting the matches in it and fetching them read the same pages.
+auto get_sample_clause(double const percent, uint64_t const number_of_rows)
+{
+    if (percent <= 0 || percent >= 100 || number_of_rows <= maximum_rows_searched_in_full)
+        return ""s;
+    return fmt::format(" tablesample system ({} percent) repeatable (1)", percent);
+}
+
+auto describe_fallback(blocked_table_fallback const fallback)
+{
+    return fallback == blocked_table_fallback::readpast ? "READPAST"s : "READ UNCOMMITTED"s;
+}
+
+// The search is usually case insensitive, so this finds where the match starts without regard to ASCII case.
+// There is no offset if the match is beyond the part of the value that was returned.
+auto find_match_offset(string_view const value, string_view const to_find)
+{
+    auto const same_letter = [](char a, char b) { return tolower(static_cast<unsigned char>(a)) == tolower(static_cast<unsigned char>(b)); };
+    auto const found = search(begin(value), end(value), begin(to_find), end(to_find), same_letter);
+    return found == end(value) ? optional<size_t>() : static_cast<size_t>(found - begin(value));
+}
+
+// Values are truncated to this length, plus one character to show that they were truncated.
+int const max_string = 500;
+
+// Row locators are fetched up to this length, plus one character to show that they were truncated. Each character
+// may be fetched as four hexadecimal digits, so this is the longest locator that fits in a varchar(8000).
+int const max_locator = 1999;
+
+auto get_search_condition(string_view const column, string_view const to_find)
+{
+    return enquote(column) + " like '%" + escape_search_text(to_find) + "%' escape '\\'";
+}
+
+// Values converted to varchar lose any characters outside the column's code page, so when UTF-8 is needed they are
+// fetched as the hexadecimal bytes of their UTF-16 form instead.
+auto utf16_hex_to_utf8(string_view const hex)
+{
+    auto const nibble = [](char const c) { return static_cast<uint32_t>(c <= '9' ? c - '0' : (c | 0x20) - 'a' + 10); };
+    auto const unit_at = [&](size_t const i) {
+        auto const unit = hex.data() + 4 * i;
+        return nibble(unit[2]) << 12 | nibble(unit[3]) << 8 | nibble(unit[0]) << 4 | nibble(unit[1]);
+    };
+    auto const is_high_surrogate = [](uint32_t const unit) { return unit >= 0xd800 && unit < 0xdc00; };
+    auto const is_low_surrogate = [](uint32_t const unit) { return unit >= 0xdc00 && unit < 0xe000; };
+
+    string utf8;
+    auto const units = hex.size() / 4;
+    utf8.reserve(units);
+    for (size_t i = 0; i < units; ++i)
+    {
+        auto code_point = unit_at(i);
+        if (is_high_surrogate(code_point) && i + 1 < units && is_low_surrogate(unit_at(i + 1)))
+            code_point = 0x10000 + ((code_point - 0xd800) << 10) + (unit_at(++i) - 0xdc00);
+        else if (is_high_surrogate(code_point) || is_low_surrogate(code_point))
+            code_point = 0xfffd;
+
+        if (code_point < 0x80)
+        {
+            utf8 += static_cast<char>(code_point);
+        }
+        else if (code_point < 0x800)
+        {
+            utf8 += static_cast<char>(0xc0 | code_point >> 6);
+            utf8 += static_cast<char>(0x80 | (code_point & 0x3f));
+        }
+        else if (code_point < 0x10000)
+        {
+            utf8 += static_cast<char>(0xe0 | code_point >> 12);
+            utf8 += static_cast<char>(0x80 | (code_point >> 6 & 0x3f));
+            utf8 += static_cast<char>(0x80 | (code_point & 0x3f));
+        }
+        else
+        {
+            utf8 += static_cast<char>(0xf0 | code_point >> 18);
+            utf8 += static_cast<char>(0x80 | (code_point >> 12 & 0x3f));
+            utf8 += static_cast<char>(0x80 | (code_point >> 6 & 0x3f));
+            utf8 += static_cast<char>(0x80 | (code_point & 0x3f));
+        }
+    }
+    return utf8;
+}
+
+// Shortens text that was fetched with one extra character back to the given length, converting it to UTF-8 if
+// it was fetched as UTF-16. Returns whether the text was too long.
+auto decode_fetched_text(string & text, int const length, bool const fetch_utf8)
+{
+    // Each UTF-16 code unit is fetched as four hexadecimal digits.
+    auto const digits_per_character = fetch_utf8 ? 4u : 1u;
+    auto const truncated = text.length() > length * digits_per_character;
+    if (truncated)
+        text.resize(length * digits_per_character);
+    if (fetch_utf8)
+        text = utf16_hex_to_utf8(text);
+    return truncated;
+}
+
+auto get_locator_expression(string_view const locator, bool const fetch_utf8)
+{
+    if (locator.empty())
+        return "null"s;
+    auto const text = "cast(left(cast(" + string(locator) + " as nvarchar(max)), " + to_string(max_locator + 1) + ") as nvarchar(" + to_string(max_locator + 1) + "))";
+    if (fetch_utf8)
+        return "convert(varchar(" + to_string(4 * (max_locator + 1)) + "), cast(" + text + " as varbinary(" + to_string(2 * (max_locator + 1)) + ")), 2)";
+    return text;
+}
+
+auto build_search_query(string_view const database, string_view const schema, string_view const table, string_view const column, string_view const locator, string_view const to_find, string_view const table_hint, bool const fetch_utf8)
+{
+    stringstream query;
+    if (fetch_utf8)
+        query << "select convert(varchar(" << 4 * (max_string + 1) << "), cast(cast(left(" << enquote(column) << ", " << (max_string + 1) << ") as nvarchar(" << (max_string + 1) << ")) as varbinary(" << 2 * (max_string + 1) << ")), 2), ";
+    else
+        query << "select cast(left(" << enquote(column) << ", " << (max_string + 1) << ") as varchar(" << (max_string + 1) << ")), ";
+    query << get_locator_expression(locator, fetch_utf8) << " from " << enquote(database) << "." << enquote(schema) << "." << enquote(table) << table_hint << " where " << get_search_condition(column, to_find);
+    return query.str();
+}
+
+// Counts the rows in a sample of a table and how many of them match, so that the number of matches in the
+// whole table can be estimated.
+auto count_sample_matches(session & sql, string_view const isolation_level_command, string_view const database, string_view const schema, string_view const table, string_view const column, string_view const to_find, string_view const table_hint)
+{
+    sample_counts counts{ 0, 0, false };
+    sql << string(isolation_level_command) + ";select count_big(*), count_big(case when " + get_search_condition(column, to_find) + " then 1 end) from " + enquote(database) + "." + enquote(schema) + "." + enquote(table) + string(table_hint),
+        into(counts.sampled_rows), into(counts.matching_rows);
+    return counts;
+}
+
+// Fetches matching values in batches of a fixed size, passing each batch to the handler as it arrives,
+// so that memory use does not grow with the number of matches.
+template <typename Handler>
+auto stream_matches(session & sql, string_view const isolation_level_command, string_view const database, string_view const schema, string_view const table, string_view const column, string_view const locator, string_view const to_find, string_view const match_text, bool const fetch_utf8, size_t const maximum_matches, string_view const table_hint, attempt_registry & attempts, size_t const column_index, query_timings & timings, Handler const & on_matches)
+{
+    size_t const fetch_rows = 1000;
+    vector<string> matches(min(maximum_matches, fetch_rows));
+    vector<string> locators(matches.size());
+    vector<indicator> locator_indicators(matches.size());
+    auto const query = string(isolation_level_command) + ";" + build_search_query(database, schema, table, column, locator, to_find, table_hint, fetch_utf8);
+    statement matches_statement = (sql.prepare << query, into(matches), into(locators, locator_indicators));
+    auto const handle = static_cast<odbc_statement_backend *>(matches_statement.get_backend())->hstmt_;
+    if (!attempts.attach(column_index, handle))
+        return;
+    try
+    {
+        auto const started_at = chrono::steady_clock::now();
+        {
+            trace_span span("execute", "query");
+            matches_statement.execute();
+        }
+        auto fetch_started_at = chrono::steady_clock::now();
+        timings.execute = fetch_started_at - started_at;
+        size_t fetched = 0;
+        auto const fetch_next = [&] {
+            trace_span span("fetch", "query");
+            auto const fetched_rows = matches_statement.fetch();
+            auto const now = chrono::steady_clock::now();
+            timings.fetch += now - fetch_started_at;
+            if (timings.first_row == chrono::duration<double>::zero())
+                timings.first_row = now - started_at;
+            return fetched_rows;
+        };
+        while (fetched < maximum_matches && fetch_next())
+        {
+            fetched += matches.size();
+            timings.rows += matches.size();
+            vector<found_match> found;
+            found.reserve(matches.size());
+            for (size_t i = 0; i != matches.size(); ++i)
+            {
+                auto& match = matches[i];
+                timings.bytes += match.length() + (locator_indicators[i] == i_ok ? locators[i].length() : 0);
+                auto const truncated = decode_fetched_text(match, max_string, fetch_utf8);
+                auto const offset = find_match_offset(match, match_text);
+                optional<string> row_locator;
+                if (locator_indicators[i] == i_ok)
+                {
+                    if (decode_fetched_text(locators[i], max_locator, fetch_utf8))
+                        locators[i] += "... <truncated>";
+                    row_locator = move(locators[i]);
+                }
+                found.push_back({ move(match), truncated, offset, move(row_locator) });
+            }
+            on_matches(move(found));
+            fetch_started_at = chrono::steady_clock::now();
+            auto const next_fetch_rows = min(maximum_matches - fetched, fetch_rows);
+            matches.resize(next_fetch_rows);
+            locators.resize(next_fetch_rows);
+            locator_indicators.resize(next_fetch_rows);
+        }
+    }
+    catch (...)
+    {
+        attempts.detach(column_index, handle);
+        throw;
+    }
+    attempts.detach(column_index, handle);
+}
+
+auto find_matches(session & sql, string_view const isolation_level_command, string_view const database, string_view const schema, string_view const table, string_view const column, string_view const locator, string_view const to_find, string_view const match_text, bool const fetch_utf8, int const maximum_results_per_column, string_view const table_hint, attempt_registry & attempts, size_t const column_index, query_timings & timings)
+{
+    vector<found_match> found;
+    stream_matches(sql, isolation_level_command, database, schema, table, column, locator, to_find, match_text, fetch_utf8, static_cast<size_t>(maximum_results_per_column) + 1, table_hint, attempts, column_index, timings, [&found](vector<found_match> batch) {
+        move(begin(batch), end(batch), back_inserter(found));
+    });
+    return found;
+}
+
+
+class stop_signal
+{
+public:
+    void stop()
+    {
+        {
+            lock_guard<mutex> lock(mutex_);
+            stopping_ = true;
+        }
+        stop_requested_.notify_all();
+    }
+
+    bool wait_for(chrono::steady_clock::duration const timeout)
+    {
+        unique_lock<mutex> lock(mutex_);
+        return stop_requested_.wait_for(lock, timeout, [this] { return stopping_; });
+    }
+
+private:
+    mutex mutex_;
+    condition_variable stop_requested_;
+    bool stopping_ = false;
+};
+
+struct server_load_sample
+{
+    double runnable_tasks_per_scheduler;
+    uint64_t number_of_schedulers;
+    uint64_t page_io_latch_wait_ms;
+    uint64_t signal_wait_ms;
+    chrono::steady_clock::time_point taken_at;
+};
+
+auto sample_server_load(session & sql)
+{
+    server_load_sample sample{};
+    sql << "select "
+        "(select avg(cast(runnable_tasks_count as float)) from sys.dm_os_schedulers where status = 'VISIBLE ONLINE'), "
+        "(select count(*) from sys.dm_os_schedulers where status = 'VISIBLE ONLINE'), "
+        "(select isnull(sum(wait_time_ms), 0) from sys.dm_os_wait_stats where wait_type like 'PAGEIOLATCH%'), "
+        "(select isnull(sum(signal_wait_time_ms), 0) from sys.dm_os_wait_stats)",
+        into(sample.runnable_tasks_per_scheduler), into(sample.number_of_schedulers), into(sample.page_io_latch_wait_ms), into(sample.signal_wait_ms);
+    sample.taken_at = chrono::steady_clock::now();
+    return sample;
+}
+
+auto get_session_statistics(session & sql)
+{
+    session_statistics statistics{};
+    sql << "select cast(cpu_time as bigint), logical_reads from sys.dm_exec_sessions where session_id = @@spid", into(statistics.cpu_ms), into(statistics.logical_reads);
+    return statistics;
+}
+
+auto choose_concurrency(server_load_sample const & previous, server_load_sample const & current, int const concurrency, throttle_settings const & settings)
+{
+    // Signal waits accumulated per millisecond are the average number of tasks queued for a CPU,
+    // and PAGEIOLATCH waits per millisecond are the average number of tasks waiting on a data page read.
+    double const cpu_pressure_high = 1.0;
+    double const cpu_pressure_low = 0.25;
+    double const io_waiters_high = 8.0;
+    double const io_waiters_low = 2.0;
+
+    double const elapsed_ms = chrono::duration<double, milli>(current.taken_at - previous.taken_at).count();
+    if (elapsed_ms <= 0 || current.number_of_schedulers == 0)
+        return concurrency;
+
+    double const queued_for_cpu = (current.signal_wait_ms - previous.signal_wait_ms) / elapsed_ms / current.number_of_schedulers;
+    double const cpu_pressure = max(queued_for_cpu, current.runnable_tasks_per_scheduler);
+    double const io_waiters = (current.page_io_latch_wait_ms - previous.page_io_latch_wait_ms) / elapsed_ms;
+    write_verbose(fmt::format("Server load: {:.2f} runnable tasks per scheduler, {:.2f} tasks waiting on page reads.", cpu_pressure, io_waiters));
+
+    if (cpu_pressure > cpu_pressure_high || io_waiters > io_waiters_high)
+        return max(settings.minimum_concurrency, concurrency / 2);
+    if (cpu_pressure < cpu_pressure_low && io_waiters < io_waiters_low)
+        return min(settings.maximum_concurrency, concurrency + 1);
+    return concurrency;
+}
+
+// Samples the health of one server over its own session and grows or shrinks the number of concurrent search queries sent to it.
+class adaptive_throttle
+{
+public:
+    adaptive_throttle(string const & connection_string, work_queue & queue, size_t const endpoint, throttle_settings const & settings)
+        : queue_(queue), endpoint_(endpoint), settings_(settings), monitor_([this, connection_string] { run(connection_string); })
+    {
+    }
+
+    ~adaptive_throttle()
+    {
+        stop_.stop();
+        monitor_.join();
+    }
+
+    adaptive_throttle(adaptive_throttle const &) = delete;
+    adaptive_throttle & operator=(adaptive_throttle const &) = delete;
+
+private:
+    void run(string const & connection_string)
+    {
+        auto const sample_interval = chrono::seconds(3);
+        try
+        {
+            auto sql = open_session(connection_string, -1);
+            auto previous = sample_server_load(*sql);
+            while (!stop_.wait_for(sample_interval))
+            {
+                auto const current = sample_server_load(*sql);
+                auto const concurrency = queue_.get_limit(endpoint_);
+                auto const chosen = choose_concurrency(previous, current, concurrency, settings_);
+                previous = current;
+                if (chosen > concurrency && queue_.get_active(endpoint_) < concurrency)
+                    continue;   // do not grow while existing slots are idle
+                if (chosen != concurrency)
+                {
+                    write_verbose("Changing number of concurrent queries from "s + to_string(concurrency) + " to " + to_string(chosen) + ".");
+                    queue_.set_limit(endpoint_, chosen);
+                }
+            }
+        }
+        catch (exception & e)
+        {
+            write_error("Unable to monitor server load, so concurrency will no longer be adjusted: "s + e.what());
+        }
+    }
+
+    work_queue & queue_;
+    size_t const endpoint_;
+    throttle_settings const settings_;
+    stop_signal stop_;
+    thread monitor_;
+};
+
+auto get_trace_detail(search_job const & job, column_details const & column, size_t const endpoint)
+{
+    auto const & target = job.targets[column.target];
+    return job.endpoints[endpoint].name + ":" + target.database + "." + column.schema + "." + column.table + "." + column.column;
+}
+
+// Keeps the idle sessions to each endpoint for whichever worker searches there next. An endpoint has no more
+// sessions open than it is allowed concurrent queries, and they are closed once its server has nothing left to search.
+class session_pool
+{
+public:
+    struct pooled_session
+    {
+        unique_ptr<session> sql;
+        optional<session_statistics> statistics_baseline;
+    };
+
+    explicit session_pool(work_queue & queue, size_t const number_of_endpoints) : queue_(queue), idle_(number_of_endpoints) {}
+
+    // Returns an idle session, or an empty one for the caller to connect if there are none.
+    pooled_session acquire(size_t const endpoint)
+    {
+        lock_guard<mutex> lock(mutex_);
+        auto& idle = idle_[endpoint];
+        if (idle.empty())
+            return {};
+        auto pooled = move(idle.back());
+        idle.pop_back();
+        return pooled;
+    }
+
+    // Must be called while the search that used the session is still active in the work queue.
+    void release(size_t const endpoint, pooled_session pooled)
+    {
+        vector<pooled_session> closing;
+        {
+            lock_guard<mutex> lock(mutex_);
+            auto& idle = idle_[endpoint];
+            if (!queue_.has_work(endpoint))
+            {
+                closing = move(idle);
+                idle.clear();
+            }
+            else if (pooled.sql && static_cast<int>(idle.size()) + queue_.get_active(endpoint) <= queue_.get_limit(endpoint))
+            {
+                idle.push_back(move(pooled));
+            }
+        }
+        // Sessions left in pooled or closing disconnect here, without holding up other workers.
+    }
+
+private:
+    work_queue & queue_;
+    mutex mutex_;
+    vector<vector<pooled_session>> idle_;
+};
+
+auto search_worker(search_job & job, session_pool & sessions)
+{
+    auto const retry_delay = chrono::milliseconds(max(job.blocking.lock_timeout_ms, 1000));
+    while (auto item = job.queue.pop())
+    {
+        auto const column_index = item->column_index;
+        auto const & column = job.columns[column_index];
+        if (auto over_budget = job.cost.admit(column_index, column.number_of_bytes, job.throughput.estimate_duration(column.number_of_bytes)))
+        {
+            search_result skipped{ column_index, column, {}, nullptr, item->deferrals, item->blocked_reason, false, true };
+            skipped.budget_reason = move(over_budget.value());
+            job.attempts.finish(column_index);
+            job.queue.complete(item.value());
+            job.results.push(move(skipped));
+            continue;
+        }
+        if (!job.attempts.start_attempt(item.value()))
+        {
+            job.queue.complete(item.value());
+            continue;
+        }
+
+        auto const & target = job.targets[column.target];
+        auto const use_fallback = job.blocking.fallback != blocked_table_fallback::none && item->deferrals >= job.blocking.maximum_deferrals;
+        // The fallback hints are locking hints, which SQL Server rejects under snapshot isolation.
+        auto const isolation_level_command = use_fallback ? "set transaction isolation level read committed"s : target.isolation_level_command;
+        search_result result{ column_index, column, {}, nullptr, item->deferrals, item->blocked_reason, use_fallback, false };
+        auto const started_at = chrono::steady_clock::now();
+        optional<string> lock_timeout;
+        bool streamed_matches = false;
+        query_timings timings;
+        auto pooled = sessions.acquire(item->endpoint);
+        try
+        {
+            trace_span span("search", "query", active_trace != nullptr ? get_trace_detail(job, column, item->endpoint) : ""s);
+            auto& sql = pooled.sql;
+            if (!sql)
+            {
+                trace_span connect_span("connect", "query", active_trace != nullptr ? job.endpoints[item->endpoint].name : ""s);
+                auto const connect_started_at = chrono::steady_clock::now();
+                sql = open_session(job.endpoints[item->endpoint].connection_string, job.blocking.lock_timeout_ms);
+                job.metrics.record_connect(column.target, chrono::steady_clock::now() - connect_started_at);
+            }
+            if (job.collect_server_statistics && !pooled.statistics_baseline.has_value())
+                pooled.statistics_baseline = get_session_statistics(*sql);
+            job.budget.consume(column.number_of_bytes);
+            auto const sample_clause = get_sample_clause(job.sample_percent, column.number_of_rows);
+            auto const table_hint = sample_clause + (use_fallback ? get_table_hint(job.blocking.fallback) : ""s);
+            if (job.sample_percent > 0)
+            {
+                result.sample = count_sample_matches(*sql, isolation_level_command, target.search_database, column.schema, column.table, column.column, job.to_find, table_hint);
+                result.sample->sampled = !sample_clause.empty();
+            }
+
+            auto const any_to_fetch = !result.sample.has_value() || result.sample->matching_rows > 0;
+            if (any_to_fetch && job.stream_all)
+            {
+                stream_matches(*sql, isolation_level_command, target.search_database, column.schema, column.table, column.column, column.locator, job.to_find, job.match_text, job.fetch_utf8, numeric_limits<size_t>::max(), table_hint, job.attempts, column_index, timings, [&](vector<found_match> batch) {
+                    streamed_matches = true;
+                    job.results.push({ column_index, column, move(batch), nullptr, item->deferrals, item->blocked_reason, use_fallback, false, {}, true });
+                });
+            }
+            else if (any_to_fetch)
+            {
+                result.matches = find_matches(*sql, isolation_level_command, target.search_database, column.schema, column.table, column.column, column.locator, job.to_find, job.match_text, job.fetch_utf8, job.maximum_results_per_column, table_hint, job.attempts, column_index, timings);
+            }
+        }
+        catch (odbc_soci_error & e)
+        {
+            if (is_lock_timeout(e))
+                lock_timeout = e.what();
+            else
+                result.error = current_exception();
+        }
+        catch (...)
+        {
+            result.error = current_exception();
+        }
+
+        // The session's totals are read after every search, so the difference is what the search cost the server.
+        auto& baseline = pooled.statistics_baseline;
+        if (baseline.has_value())
+        {
+            try
+            {
+                auto const current = get_session_statistics(*pooled.sql);
+                result.server_statistics = session_statistics{ current.cpu_ms - baseline->cpu_ms, current.logical_reads - baseline->logical_reads };
+                baseline = current;
+            }
+            catch (soci_error const &)
+            {
+                baseline.reset();
+            }
+        }
+        sessions.release(item->endpoint, move(pooled));
+
+        auto const succeeded = !result.error && !lock_timeout.has_value();
+        job.metrics.record_query(column.target, timings, column.number_of_bytes, succeeded);
+        if (!job.attempts.end_attempt(column_index, succeeded))
+        {
+            // Another attempt at this column has finished first or is still running.
+            job.queue.complete(item.value());
+            continue;
+        }
+
+        // Matches that have already been output cannot be taken back, so a column is only retried if none were.
+        if (lock_timeout.has_value() && item->deferrals < job.blocking.maximum_deferrals && !streamed_matches)
+        {
+            write_verbose("Deferring "s + column.schema + "." + column.table + "." + column.column + " because the table is locked.");
+            ++item->deferrals;
+            item->blocked_reason = lock_timeout.value();
+            job.metrics.record_lock_timeout_retry(column.target);
+            if (active_trace != nullptr)
+                trace_instant("deferred", "retry", get_trace_detail(job, column, item->endpoint));
+            job.queue.defer(move(item.value()), retry_delay);
+            continue;
+        }
+
+        if (lock_timeout.has_value())
+        {
+            result.blocked_reason = lock_timeout.value();
+            result.searched_with_fallback = false;
+            result.skipped = true;
+        }
+
+        auto const search_time = chrono::steady_clock::now() - started_at;
+        result.search_time = search_time;
+        if (succeeded)
+            job.throughput.record(column.number_of_bytes, search_time);
+        else
+            job.attempts.finish(column_index);
+        job.queue.complete(item.value());
+        job.results.push(move(result));
+    }
+}
+
+// Periodically looks for searches that are taking much longer than the throughput seen so far
+// suggests they should, and starts another attempt at them on a different endpoint.
+class straggler_hedger
+{
+public:
+    straggler_hedger(search_job & job, double const hedge_factor)
+        : job_(job), hedge_factor_(hedge_factor), monitor_([this] { run(); })
+    {
+    }
+
+    ~straggler_hedger()
+    {
+        stop_.stop();
+        monitor_.join();
+    }
+
+    straggler_hedger(straggler_hedger const &) = delete;
+    straggler_hedger & operator=(straggler_hedger const &) = delete;
+
+private:
+    void run()
+    {
+        name_trace_thread("hedger");
+        auto const check_interval = chrono::milliseconds(500);
+        chrono::duration<double> const minimum_delay = chrono::seconds(5);
+        while (!stop_.wait_for(check_interval))
+        {
+            auto stragglers = job_.attempts.take_stragglers([this, minimum_delay](size_t const column_index, chrono::steady_clock::duration const elapsed) {
+                auto const expected = job_.throughput.estimate_duration(job_.columns[column_index].number_of_bytes);
+                return expected.has_value() && elapsed > max(minimum_delay, expected.value() * hedge_factor_);
+            });
+            for (auto& item : stragglers)
+            {
+                auto const & column = job_.columns[item.column_index];
+                write_verbose("Searching "s + column.schema + "." + column.table + "." + column.column + " on another endpoint because it is taking longer than expected.");
+                job_.metrics.record_hedge(column.target);
+                if (active_trace != nullptr)
+                    trace_instant("hedge", "retry", column.schema + "." + column.table + "." + column.column);
+                job_.queue.hedge(move(item));
+            }
+        }
+    }
+
+    search_job & job_;
+    double const hedge_factor_;
+    stop_signal stop_;
+    thread monitor_;
+};
+
+class search_workers
+{
+public:
+    search_workers(search_job & job, int number_of_workers) : job_(job), sessions_(job.queue, job.endpoints.size())
+    {
+        for (int i = 0; i != number_of_workers; ++i)
+        {
+            threads_.emplace_back([this, &job, i] {
+                name_trace_thread("search worker " + to_string(i + 1));
+                search_worker(job, sessions_);
+            });
+        }
+    }
+
+    ~search_workers()
+    {
+        job_.queue.stop();
+        job_.results.close();
+        for (auto& worker : threads_)
+            worker.join();
+    }
+
+    search_workers(search_workers const &) = delete;
+    search_workers & operator=(search_workers const &) = delete;
+
+private:
+    search_job & job_;
+    session_pool sessions_;
+    vector<thread> threads_;
+};
 
-string const clear_eol = "\033[0K"s;
+struct deferral_summary
+{
+    int deferrals = 0;
+    int columns_searched_with_fallback = 0;
+    int columns_skipped = 0;
+    string reason;
+};
 
-auto write_colour(string_view const message, fmt::color colour)
+auto display_deferral_summary(map<string, deferral_summary> const & deferred_tables, blocked_table_fallback const fallback)
 {
-    fmt::print(fmt::fg(colour), "{}{}\n", clear_eol, message);
+    if (deferred_tables.empty())
+        return;
+
+    write_colour("Tables deferred because they were locked:", fmt::color::yellow);
+    for (auto const & [table, summary] : deferred_tables)
+    {
+        string outcome = "deferred " + to_string(summary.deferrals) + (summary.deferrals == 1 ? " time" : " times");
+        if (summary.columns_searched_with_fallback > 0)
+            outcome += ", " + to_string(summary.columns_searched_with_fallback) + " column(s) searched with " + describe_fallback(fallback);
+        if (summary.columns_skipped > 0)
+            outcome += ", " + to_string(summary.columns_skipped) + " column(s) skipped";
+        write_colour("    "s + table + ": " + outcome + " (" + summary.reason + ")", fmt::color::yellow);
+    }
 }
 
-auto write_verbose(string_view const message)
+// Holds back results that complete out of order so that they are displayed in catalog order, as
+// they would be by a serial search. If the results held back need more than the memory budget,
+// the earliest of them are released out of order.
+class result_reorder_buffer
+{
+public:
+    result_reorder_buffer(size_t const number_of_columns, output_settings const & output)
+        : enabled_(output.ordered), memory_budget_bytes_(static_cast<uint64_t>(output.reorder_memory_megabytes) * 1024 * 1024), released_(number_of_columns)
+    {
+    }
+
+    template <typename Function>
+    void add(search_result result, Function const & display)
+    {
+        if (!enabled_)
+        {
+            display(result);
+            return;
+        }
+
+        held_bytes_ += get_size(result);
+        auto const column_index = result.column_index;
+        held_.emplace(column_index, move(result));
+        while (!held_.empty() && held_.begin()->first == next_)
+            release(held_.begin(), display);
+
+        if (held_bytes_ > memory_budget_bytes_ && !out_of_order_)
+        {
+            write_verbose("Displaying some results out of order because too many are waiting for earlier columns to be searched.");
+            out_of_order_ = true;
+        }
+        while (held_bytes_ > memory_budget_bytes_ && !held_.empty())
+            release(held_.begin(), display);
+    }
+
+private:
+    template <typename Function>
+    void release(map<size_t, search_result>::iterator const held, Function const & display)
+    {
+        held_bytes_ -= get_size(held->second);
+        released_[held->first] = true;
+        display(held->second);
+        held_.erase(held);
+        while (next_ != released_.size() && released_[next_])
+            ++next_;
+    }
+
+    static uint64_t get_size(search_result const & result)
+    {
+        return accumulate(begin(result.matches), end(result.matches), static_cast<uint64_t>(sizeof(search_result)), [](uint64_t acc, found_match const & match) { return acc + match.value.size(); });
+    }
+
+    bool const enabled_;
+    uint64_t const memory_budget_bytes_;
+    map<size_t, search_result> held_;
+    vector<bool> released_;
+    size_t next_ = 0;
+    uint64_t held_bytes_ = 0;
+    bool out_of_order_ = false;
+};
+
+auto escape_prometheus_label(string_view const text)
 {
-    if (verbose_messages_enabled)
+    string escaped;
+    for (auto const c : text)
     {
-        write_colour(message, fmt::color::green);
+        if (c == '\\' || c == '"')
+            escaped += '\\';
+        if (c == '\n')
+            escaped += "\\n";
+        else
+            escaped += c;
     }
+    return escaped;
 }
 
-auto write_error(string_view const message)
+// Formats the metrics in the Prometheus text format, for node exporter's textfile collector.
+auto format_prometheus_metrics(search_job & job)
 {
-    fmt::print(fmt::fg(fmt::color::red), "{}\n", message);
+    auto const snapshot = job.metrics.get_snapshot();
+    string text;
+    auto const add_metric = [&](string_view const name, string_view const type, string_view const help, auto const & get_value) {
+        text += fmt::format("# HELP {} {}\n# TYPE {} {}\n", name, help, name, type);
+        for (size_t i = 0; i != snapshot.size(); ++i)
+        {
+            auto const & target = job.targets[i];
+            text += fmt::format("{}{{server=\"{}\",database=\"{}\"}} {}\n", name, escape_prometheus_label(job.servers[target.server].name), escape_prometheus_label(target.database), get_value(snapshot[i]));
+        }
+    };
+    add_metric("sqlgrep_queries_total", "counter", "Search queries run.", [](database_metrics const & m) { return m.queries; });
+    add_metric("sqlgrep_query_errors_total", "counter", "Search queries that failed.", [](database_metrics const & m) { return m.errors; });
+    add_metric("sqlgrep_connections_total", "counter", "Connections opened for searching.", [](database_metrics const & m) { return m.connections; });
+    add_metric("sqlgrep_connect_seconds_total", "counter", "Time spent opening connections.", [](database_metrics const & m) { return m.connect_seconds; });
+    add_metric("sqlgrep_query_execute_seconds_total", "counter", "Time spent executing search queries.", [](database_metrics const & m) { return m.execute_seconds; });
+    add_metric("sqlgrep_query_first_row_seconds_total", "counter", "Time from executing each search query to its first fetch returning.", [](database_metrics const & m) { return m.first_row_seconds; });
+    add_metric("sqlgrep_query_fetch_seconds_total", "counter", "Time spent fetching the results of search queries.", [](database_metrics const & m) { return m.fetch_seconds; });
+    add_metric("sqlgrep_rows_returned_total", "counter", "Matching rows returned.", [](database_metrics const & m) { return m.rows; });
+    add_metric("sqlgrep_bytes_returned_total", "counter", "Bytes of matching values and locators returned.", [](database_metrics const & m) { return m.bytes; });
+    add_metric("sqlgrep_scanned_bytes_total", "counter", "Bytes of table data in the tables searched.", [](database_metrics const & m) { return m.scanned_bytes; });
+    add_metric("sqlgrep_lock_timeout_retries_total", "counter", "Searches retried later because the table was locked.", [](database_metrics const & m) { return m.lock_timeout_retries; });
+    add_metric("sqlgrep_hedges_total", "counter", "Searches started again on another endpoint because they were slow.", [](database_metrics const & m) { return m.hedges; });
+    text += fmt::format("# HELP sqlgrep_run_seconds Time since the search started.\n# TYPE sqlgrep_run_seconds gauge\nsqlgrep_run_seconds {}\n", job.metrics.get_elapsed().count());
+    return text;
 }
 
-class database_query_logger : public logger_impl
+auto format_json_metrics(search_job & job)
+{
+    auto const snapshot = job.metrics.get_snapshot();
+    string text = fmt::format("{{\"elapsed_seconds\":{},\"databases\":[", job.metrics.get_elapsed().count());
+    for (size_t i = 0; i != snapshot.size(); ++i)
+    {
+        auto const & target = job.targets[i];
+        auto const & m = snapshot[i];
+        text += fmt::format("{}{{\"server\":{},\"database\":{},\"queries\":{},\"errors\":{},\"connections\":{},\"connect_seconds\":{},\"execute_seconds\":{},\"first_row_seconds\":{},\"fetch_seconds\":{},\"rows\":{},\"bytes\":{},\"scanned_bytes\":{},\"lock_timeout_retries\":{},\"hedges\":{}}}",
+            i == 0 ? "" : ",", escape_json_string(job.servers[target.server].name), escape_json_string(target.database), m.queries, m.errors, m.connections, m.connect_seconds, m.execute_seconds, m.first_row_seconds, m.fetch_seconds, m.rows, m.bytes, m.scanned_bytes, m.lock_timeout_retries, m.hedges);
+    }
+    return text + "]}\n";
+}
+
+// Writes the metrics files when the search finishes and, if given an interval, while it runs.
+class metrics_exporter
 {
 public:
-    void start_query(std::string const & query) override
+    metrics_exporter(search_job & job, output_settings const & output) : job_(job), output_(output)
     {
-        write_verbose("Query: "s + query);
+        if (output_.metrics_interval_seconds > 0)
+            writer_ = thread([this] { run(); });
+    }
+
+    ~metrics_exporter()
+    {
+        stop_.stop();
+        if (writer_.joinable())
+            writer_.join();
+        try
+        {
+            write();
+        }
+        catch (exception const & e)
+        {
+            write_error("Unable to write the metrics: "s + e.what());
+        }
     }
 
+    metrics_exporter(metrics_exporter const &) = delete;
+    metrics_exporter & operator=(metrics_exporter const &) = delete;
+
 private:
-    logger_impl* do_clone() const override
+    void run()
     {
-        return new database_query_logger;   // `new` is required by SOCI
+        while (!stop_.wait_for(chrono::seconds(output_.metrics_interval_seconds)))
+        {
+            try
+            {
+                write();
+            }
+            catch (exception const & e)
+            {
+                write_verbose("Unable to write the metrics: "s + e.what());
+            }
+        }
     }
+
+    void write()
+    {
+        if (output_.prometheus_metrics_path.has_value())
+            replace_file(output_.prometheus_metrics_path.value(), format_prometheus_metrics(job_));
+        if (output_.json_metrics_path.has_value())
+            replace_file(output_.json_metrics_path.value(), format_json_metrics(job_));
+    }
+
+    search_job & job_;
+    output_settings const & output_;
+    stop_signal stop_;
+    thread writer_;
 };
 
-auto write_progress(uint64_t total, uint64_t completed, chrono::duration<uint64_t, std::nano> time_taken_so_far)
+auto display_column_matches(search_job const & job, search_result & result, match_writer & writer)
 {
-    uint64_t const nanoseconds_per_second = 1'000'000'000L;
-    uint64_t const seconds_so_far = time_taken_so_far.count() / nanoseconds_per_second;
-    uint64_t const estimated_total_seconds = seconds_so_far * total / completed;
-    uint64_t const remaining_seconds = estimated_total_seconds - seconds_so_far;
-    auto const percent_complete = completed * 100 / total;
-    fmt::print("{}{}% complete", clear_eol, percent_complete);
-    if (percent_complete > 10)
-        fmt::print(" ({} seconds remaining)...", remaining_seconds);
-    fmt::print("\r");
+    auto const maximum_results_per_column = job.maximum_results_per_column;
+    auto & matches = result.matches;
+    if (matches.empty())
+        return;
+
+    auto const more_available = matches.size() > maximum_results_per_column;
+    if (more_available)
+        matches.resize(maximum_results_per_column);
+    writer.write(job, { result.column, more_available, move(matches) });
 }
 
-auto enquote(string_view const val)
+
+auto get_query_shape(column_details const & column, bool const searched_with_fallback)
 {
-    return "\""s + string(val) + "\"";
+    return "like"s + (column.locator.empty() ? "" : "+locator") + (searched_with_fallback ? "+fallback" : "");
 }
 
-auto get_isolation_level_command(session & sql)
+auto get_cost_key(search_job const & job, column_details const & column, bool const searched_with_fallback)
 {
-    string isolation_level;
-    sql << "select case (select snapshot_isolation_state_desc from sys.databases where name = db_name()) when 'on' then 'snapshot' else 'read committed' end", into(isolation_level);
-    string const isolation_level_command = "set transaction isolation level "s + isolation_level;
-    return isolation_level_command;
+    auto const & target = job.targets[column.target];
+    return cost_model::get_key(job.servers[target.server].name, target.database, column, get_query_shape(column, searched_with_fallback));
 }
 
-auto get_number_of_rows(session & sql, string_view const isolation_level_command, string_view const schema, string_view const table, string_view const column, unordered_map<string, uint64_t> & cache)
+auto display_all_matches(search_job & job, output_settings const & output, results_database * const results, cost_model * const costs, vector<double> const & predicted_seconds, run_report * const report)
 {
-    uint64_t count;
-    stringstream query;
-    query << isolation_level_command << ";select count(*) from " << enquote(schema) << "." << enquote(table);
-    auto const query_str = query.str();
+    // Columns are weighted by their predicted search time when there is history, otherwise by table size.
+    vector<uint64_t> weights(job.columns.size());
+    for (size_t i = 0; i != job.columns.size(); ++i)
+    {
+        auto const predicted_microseconds = predicted_seconds.empty() ? 0 : static_cast<uint64_t>(predicted_seconds[i] * 1'000'000);
+        weights[i] = predicted_seconds.empty() ? progress_estimator::get_weight(job.columns[i].number_of_bytes) : max<uint64_t>(predicted_microseconds, 1);
+    }
+    auto const total_weight = accumulate(begin(weights), end(weights), 0ULL);
+    auto const total_bytes = accumulate(begin(job.columns), end(job.columns), 0ULL, [](uint64_t acc, column_details const & b) { return acc + b.number_of_bytes; });
+    auto const total_rows = accumulate(begin(job.columns), end(job.columns), 0ULL, [](uint64_t acc, column_details const & b) { return acc + b.number_of_rows; });
+    progress_estimator progress(total_weight, total_bytes, total_rows);
+    result_reorder_buffer reorder_buffer(job.columns.size(), output);
+    buffered_output match_output(stdout);
+    auto const writer = create_match_writer(output.format, match_output);
+    map<string, deferral_summary> deferred_tables;
+    auto const budgeted = job.cost.is_limited();
+    coverage_summary coverage;
+    sample_summary samples(job.sample_percent);
+    auto const display = [&job, &writer, report](search_result & ready) {
+        auto const started_at = chrono::steady_clock::now();
+        display_column_matches(job, ready, *writer);
+        if (report != nullptr)
+            report->add_output_time(chrono::steady_clock::now() - started_at);
+    };
+    auto last_displayed = chrono::steady_clock::now();
+    size_t completed_columns = 0;
+    while (completed_columns != job.columns.size())
+    {
+        auto result = job.results.pop();
+        if (result.error)
+            rethrow_exception(result.error);
 
-    auto const cached = cache.find(query_str);
-    if (cached != cache.end())
-        return cached->second;
+        if (result.partial)
+        {
+            if (results != nullptr)
+                results->add(result);
+            reorder_buffer.add(move(result), display);
+            continue;
+        }
 
-    sql << query_str, into(count);
+        ++completed_columns;
+        if (budgeted)
+            coverage.record(job, result);
+        samples.record(job, result);
+        if ((result.deferrals > 0 || result.skipped) && result.budget_reason.empty())
+        {
+            auto & summary = deferred_tables[get_location_prefix(job, result.column) + result.column.schema + "." + result.column.table];
+            summary.deferrals = max(summary.deferrals, result.deferrals);
+            summary.columns_searched_with_fallback += result.searched_with_fallback ? 1 : 0;
+            summary.columns_skipped += result.skipped ? 1 : 0;
+            summary.reason = result.blocked_reason;
+        }
 
-    cache[query_str] = count;
+        if (results != nullptr)
+            results->add(result);
 
-    return count;
+        auto const any_matches = !result.matches.empty();
+        progress.record(weights[result.column_index], result.column.number_of_bytes, result.column.number_of_rows);
+        if (costs != nullptr && !result.skipped && !(result.sample.has_value() && result.sample->sampled))
+            costs->record(get_cost_key(job, result.column, result.searched_with_fallback), result.search_time.count(), result.column.number_of_rows, result.column.number_of_bytes);
+        if (report != nullptr)
+            report->record(job, result);
+        reorder_buffer.add(move(result), display);
+
+        auto const now = chrono::steady_clock::now();
+        write_verbose(progress.describe());
+        if (status_is_terminal && (any_matches || now - last_displayed > chrono::seconds(2))) {
+            auto const progress_line = progress.format();
+            if (status_output == stdout)
+                match_output.write("{}", progress_line);
+            else
+                fmt::print(status_output, "{}", progress_line);
+            last_displayed = now;
+        }
+    }
+
+    auto const finishing_at = chrono::steady_clock::now();
+    writer->finish();
+    match_output.flush();
+    if (report != nullptr)
+        report->add_output_time(chrono::steady_clock::now() - finishing_at);
+    if (results != nullptr)
+        results->finish();
+    if (costs != nullptr)
+        costs->save();
+    display_deferral_summary(deferred_tables, job.blocking.fallback);
+    if (budgeted)
+        coverage.display();
+    if (job.sample_percent > 0)
+        samples.display();
+}
+
+auto is_database_pattern(string_view const database)
+{
+    return database.find_first_of("*?") != string_view::npos;
 }
 
-auto get_all_string_columns(session & sql, string_view const isolation_level_command)
+auto get_matching_databases(connection_settings const & connection, string_view const server, string_view const pattern)
 {
-    fmt::print("Scanning for string columns...\n");
+    auto like_pattern = escape_search_text(pattern);
+    replace(begin(like_pattern), end(like_pattern), '*', '%');
+    replace(begin(like_pattern), end(like_pattern), '?', '_');
 
-    rowset<row> data = sql.prepare <<
-        "select TABLE_SCHEMA SchemaName, TABLE_NAME TableName, COLUMN_NAME ColumnName "
-        "from INFORMATION_SCHEMA.COLUMNS c "
-        "where DATA_TYPE in('char', 'varchar', 'nchar', 'nvarchar') and "
-        "(select TABLE_TYPE from INFORMATION_SCHEMA.TABLES t where t.TABLE_SCHEMA = c.TABLE_SCHEMA and t.TABLE_NAME = c.TABLE_NAME) = 'BASE TABLE' "
-        "order by TABLE_SCHEMA, TABLE_NAME, COLUMN_NAME";
+    auto sql = open_session(build_connection_string(connection, server, "master"), -1);
+    rowset<string> names = (sql->prepare <<
+        "select name from sys.databases "
+        "where name like :pattern escape '\\' and database_id > 4 and source_database_id is null and state_desc = 'ONLINE' and has_dbaccess(name) = 1 "
+        "order by name", use(like_pattern));
+    return vector<string>(begin(names), end(names));
+}
 
-    vector<column_details> details;
-    for (auto& r : data)
+// Changes to any table, column or index move the latest modify_date in sys.objects, so together with the
+// server version and the snapshot isolation setting it tells whether a cached catalog is still current.
+auto get_schema_change_marker(session & sql)
+{
+    string marker;
+    sql << "select isnull(convert(varchar(30), max(modify_date), 126), '') + '|' + cast(serverproperty('ProductVersion') as varchar(50)) + '|' + "
+        "(select snapshot_isolation_state_desc from sys.databases where name = db_name()) from sys.objects", into(marker);
+    return marker;
+}
+
+
+struct prepared_database
+{
+    search_target target;
+    string schema_fingerprint;
+    vector<column_details> columns;
+    optional<database_snapshot> snapshot;
+    discovery_timings timings;
+};
+
+auto prepare_database(connection_settings const & connection, size_t const server_index, string const & server, string const & database, snapshot_settings const & snapshot_options, int const lock_timeout_ms, bool const locate_rows, bool const count_rows, prepared_database const * same_database_elsewhere, catalog_cache * const cache)
+{
+    auto const started_at = chrono::steady_clock::now();
+    discovery_timings timings;
+    auto const connection_string = build_connection_string(connection, server, database);
+    auto sql = open_session(connection_string, lock_timeout_ms);
+    timings.connect = chrono::steady_clock::now() - started_at;
+
+    // A snapshot gets a new name on every run, so only live databases are cached.
+    auto const use_cache = cache != nullptr && !snapshot_options.enabled;
+    string marker;
+    if (use_cache)
     {
-        column_details column{ r.get<string>(0), r.get<string>(1), r.get<string>(2), 0 };
-        details.push_back(column);
+        marker = get_schema_change_marker(*sql);
+        if (auto cached = cache->find(server, database, marker, locate_rows))
+        {
+            write_verbose("Using the cached catalog of "s + database + " on " + server + " because its schema has not changed.");
+            // Tables grow without their schema changing, so their sizes are read again from sys.partitions.
+            auto const sizing_started_at = chrono::steady_clock::now();
+            auto columns = resize_string_columns(*sql, move(cached->columns));
+            timings.sizing = chrono::steady_clock::now() - sizing_started_at;
+            timings.catalog = chrono::steady_clock::now() - started_at - timings.connect - timings.sizing;
+            return prepared_database{ { server_index, database, database, move(cached->isolation_level_command) }, move(cached->schema_fingerprint), move(columns), {}, timings };
+        }
     }
 
-    unordered_map<string, uint64_t> cache;
-    for (auto& column : details)
+    auto snapshot = snapshot_options.enabled ? open_database_snapshot(*sql, connection_string, database, snapshot_options) : optional<database_snapshot>();
+
+    string isolation_level_command;
+    if (snapshot.has_value())
+    {
+        // Nothing can change in a snapshot, so there is no need for row versioning to get a consistent view.
+        auto const connect_started_at = chrono::steady_clock::now();
+        sql = open_session(build_connection_string(connection, server, snapshot->get_name()), lock_timeout_ms);
+        timings.connect += chrono::steady_clock::now() - connect_started_at;
+        isolation_level_command = "set transaction isolation level read committed";
+    }
+    else
     {
-        column.number_of_rows = get_number_of_rows(sql, isolation_level_command, column.schema, column.table, column.column, cache);
-        write_verbose("Number of rows in "s + column.schema + "." + column.table + "." + column.column + ": " + to_string(column.number_of_rows) + ".");
+        isolation_level_command = get_isolation_level_command(*sql);
     }
 
-    return details;
+    auto schema_fingerprint = get_schema_fingerprint(*sql);
+    vector<column_details> columns;
+    if (same_database_elsewhere != nullptr && same_database_elsewhere->schema_fingerprint == schema_fingerprint)
+    {
+        write_verbose("Reusing the string columns already found in "s + database + " because the schema on " + server + " is identical.");
+        auto const sizing_started_at = chrono::steady_clock::now();
+        columns = resize_string_columns(*sql, same_database_elsewhere->columns);
+        timings.sizing = chrono::steady_clock::now() - sizing_started_at;
+    }
+    else
+    {
+        columns = get_all_string_columns(*sql, isolation_level_command, count_rows, timings.sizing);
+    }
+    if (locate_rows)
+        add_row_locators(*sql, columns);
+    if (use_cache)
+        cache->store(server, database, { move(marker), isolation_level_command, schema_fingerprint, locate_rows, columns });
+
+    timings.catalog = chrono::steady_clock::now() - started_at - timings.connect - timings.sizing;
+    auto search_database = snapshot.has_value() ? snapshot->get_name() : database;
+    return prepared_database{ { server_index, database, move(search_database), move(isolation_level_command) }, move(schema_fingerprint), move(columns), move(snapshot), timings };
 }
 
-auto escape_search_text(string_view to_find)
+template <typename Function>
+auto run_concurrently(size_t const count, int const concurrency, Function const & function)
 {
-    regex const r("([\\\\%_[])");
-    string result;
-    regex_replace(back_inserter(result), begin(to_find), end(to_find), r, "\\$1");
-    return result;
+    atomic<size_t> next{ 0 };
+    atomic<bool> failed{ false };
+    exception_ptr error;
+    vector<thread> threads;
+    for (int i = 0; i < concurrency && static_cast<size_t>(i) < count; ++i)
+    {
+        threads.emplace_back([&] {
+            for (auto index = next++; index < count && !failed; index = next++)
+            {
+                try
+                {
+                    function(index);
+                }
+                catch (...)
+                {
+                    if (!failed.exchange(true))
+                        error = current_exception();
+                }
+            }
+        });
+    }
+
+    for (auto& t : threads)
+        t.join();
+    if (error)
+        rethrow_exception(error);
 }
 
-auto find_matches(session & sql, string_view const isolation_level_command, string_view const schema, string_view const table, string_view const column, string_view const to_find, int const maximum_results_per_column)
+struct search_catalog
 {
-    int const max_string = 500;
-    vector<string> matches(maximum_results_per_column + 1);
-    stringstream query;
-    query << isolation_level_command << ";select cast(left(" << enquote(column) << ", " << (max_string + 1) << ") as varchar(" << (max_string + 1) << ")) from " << enquote(schema) << "." << enquote(table) << " where " << enquote(column) << " like '%" + escape_search_text(to_find) + "%' escape '\\'", into(matches);
-    sql << query.str(), into(matches);
-    for (vector<string>::size_type i = 0; i != matches.size(); ++i)
+    vector<search_server> servers;
+    vector<search_endpoint> endpoints;
+    vector<search_target> targets;
+    vector<column_details> columns;
+    vector<database_snapshot> snapshots;
+    discovery_timings timings;
+};
+
+auto discover_search_catalog(connection_settings const & connection, vector<search_server> const & servers, string const & database_pattern, snapshot_settings const & snapshot_options, int const concurrency, int const lock_timeout_ms, bool const locate_rows, bool const count_rows, catalog_cache * const cache)
+{
+    trace_span span("discover catalog", "catalog");
+    auto const search_many = is_database_pattern(database_pattern);
+    if (search_many && snapshot_options.name.has_value())
+        throw runtime_error("A snapshot name can only be given when searching a single database.");
+
+    // Every search session stays connected to one database and reaches the others with three-part names.
+    // The catalog is read from the first endpoint of each server.
+    search_catalog catalog{ servers };
+    vector<string> server_names;
+    for (size_t i = 0; i != servers.size(); ++i)
+    {
+        for (auto const & endpoint : servers[i].endpoints)
+            catalog.endpoints.push_back({ i, endpoint, build_connection_string(connection, endpoint, search_many ? "master"s : database_pattern) });
+        server_names.push_back(servers[i].endpoints.front());
+    }
+
+    auto const discovery_concurrency = concurrency * static_cast<int>(server_names.size());
+    vector<pair<size_t, string>> databases;
+    if (search_many)
+    {
+        vector<vector<string>> databases_by_server(server_names.size());
+        run_concurrently(server_names.size(), discovery_concurrency, [&](size_t i) {
+            trace_span span("list databases", "catalog", server_names[i]);
+            try
+            {
+                databases_by_server[i] = get_matching_databases(connection, server_names[i], database_pattern);
+            }
+            catch (soci_error & e)
+            {
+                if (server_names.size() == 1)
+                    throw;
+                write_error("Skipping server "s + server_names[i] + ": " + e.what());
+            }
+        });
+        for (size_t i = 0; i != server_names.size(); ++i)
+            for (auto const & database : databases_by_server[i])
+                databases.emplace_back(i, database);
+    }
+    else
+    {
+        for (size_t i = 0; i != server_names.size(); ++i)
+            databases.emplace_back(i, database_pattern);
+    }
+
+    if (databases.size() > 1)
+        fmt::print(status_output, "Scanning {} databases for string columns...\n", databases.size());
+    else
+        fmt::print(status_output, "Scanning for string columns...\n");
+
+    // The first copy of each database is discovered in full, and the copies on other servers
+    // reuse its columns when their schemas are identical.
+    map<string, size_t> first_copies;
+    vector<size_t> first, later;
+    for (size_t i = 0; i != databases.size(); ++i)
+    {
+        if (first_copies.emplace(databases[i].second, i).second)
+            first.push_back(i);
+        else
+            later.push_back(i);
+    }
+
+    vector<optional<prepared_database>> prepared(databases.size());
+    auto const prepare = [&](size_t i, prepared_database const * same_database_elsewhere) {
+        auto const & [server, database] = databases[i];
+        trace_span span("prepare database", "catalog", server_names[server] + ":" + database);
+        try
+        {
+            prepared[i].emplace(prepare_database(connection, server, server_names[server], database, snapshot_options, lock_timeout_ms, locate_rows, count_rows, same_database_elsewhere, cache));
+        }
+        catch (soci_error & e)
+        {
+            if (databases.size() == 1)
+                throw;
+            write_error("Skipping database "s + database + " on " + server_names[server] + ": " + e.what());
+        }
+    };
+    run_concurrently(first.size(), discovery_concurrency, [&](size_t i) { prepare(first[i], nullptr); });
+    run_concurrently(later.size(), discovery_concurrency, [&](size_t i) {
+        auto const & first_copy = prepared[first_copies.at(databases[later[i]].second)];
+        prepare(later[i], first_copy.has_value() ? &first_copy.value() : nullptr);
+    });
+
+    for (auto& database : prepared)
     {
-        if (matches[i].length() > max_string)
-            matches[i] = matches[i].substr(0, max_string) + "... <truncated>";
+        if (!database.has_value())
+            continue;
+
+        for (auto& column : database->columns)
+        {
+            column.target = catalog.targets.size();
+            catalog.columns.push_back(move(column));
+        }
+        catalog.targets.push_back(move(database->target));
+        catalog.timings.connect += database->timings.connect;
+        catalog.timings.catalog += database->timings.catalog;
+        catalog.timings.sizing += database->timings.sizing;
+        if (database->snapshot.has_value())
+            catalog.snapshots.push_back(move(database->snapshot.value()));
     }
-    return matches;
+    if (cache != nullptr)
+        cache->save();
+    return catalog;
 }
 
-auto display_all_matches(session & sql, string_view const isolation_level_command, vector<column_details> const & all_columns, string_view to_find, int const maximum_results_per_column, uint64_t total_rows)
+struct estimated_plan
+{
+    double cost;
+    double io;
+    double cpu;
+    double rows;
+    bool parallel;
+};
+
+// Runs a batch with SQLExecDirect instead of a SOCI statement, which would prepare it and so could not turn
+// SHOWPLAN on, and returns the first column of the first row if there is one.
+auto execute_directly(session & sql, string const & batch)
 {
-    uint64_t completed_rows = 0;
-    auto const start_time = chrono::steady_clock::now();
-    auto last_displayed = start_time;
-    for (auto column : all_columns)
+    auto const connection = static_cast<odbc_session_backend *>(sql.get_backend())->hdbc_;
+    SQLHSTMT handle;
+    if (is_odbc_error(SQLAllocHandle(SQL_HANDLE_STMT, connection, &handle)))
+        throw odbc_soci_error(SQL_HANDLE_DBC, connection, "allocating a statement");
+    unique_ptr<void, void (*)(SQLHSTMT)> const statement(handle, [](SQLHSTMT h) { SQLFreeHandle(SQL_HANDLE_STMT, h); });
+
+    if (is_odbc_error(SQLExecDirectA(handle, reinterpret_cast<SQLCHAR *>(const_cast<char *>(batch.c_str())), SQL_NTS)))
+        throw odbc_soci_error(SQL_HANDLE_STMT, handle, "executing " + batch);
+    SQLSMALLINT number_of_columns = 0;
+    SQLNumResultCols(handle, &number_of_columns);
+    if (number_of_columns == 0)
+        return optional<string>();
+    auto ret = SQLFetch(handle);
+    if (ret == SQL_NO_DATA)
+        return optional<string>();
+    if (is_odbc_error(ret))
+        throw odbc_soci_error(SQL_HANDLE_STMT, handle, "fetching the result of " + batch);
+
+    // The value is read in chunks because its length is not known until it has all arrived.
+    string value;
+    char buffer[8192];
+    while (true)
     {
-        auto matches = find_matches(sql, isolation_level_command, column.schema, column.table, column.column, to_find, maximum_results_per_column);
-        if (!matches.empty())
-        {
-            auto const more_available = matches.size() > maximum_results_per_column;
-            if (more_available)
-                matches.resize(maximum_results_per_column);
-            match_details match{ column, more_available, matches };
+        SQLLEN length = 0;
+        ret = SQLGetData(handle, 1, SQL_C_CHAR, buffer, sizeof(buffer), &length);
+        if (ret == SQL_NO_DATA || length == SQL_NULL_DATA)
+            break;
+        if (is_odbc_error(ret))
+            throw odbc_soci_error(SQL_HANDLE_STMT, handle, "reading the result of " + batch);
+        auto const chunk = length == SQL_NO_TOTAL || length >= static_cast<SQLLEN>(sizeof(buffer)) ? sizeof(buffer) - 1 : static_cast<size_t>(length);
+        value.append(buffer, chunk);
+        if (ret == SQL_SUCCESS)
+            break;
+    }
+    return optional<string>(move(value));
+}
 
-            write_colour(match.column.table + "." + match.column.column, fmt::color::magenta);
-            for (auto const & value : match.matches)
+auto get_plan_attributes(string const & plan, string const & name)
+{
+    regex const attribute(" " + name + "=\"([^\"]*)\"");
+    vector<string> values;
+    for (sregex_iterator found(begin(plan), end(plan), attribute), last; found != last; ++found)
+        values.push_back((*found)[1].str());
+    return values;
+}
+
+// Reads the estimates for the whole statement, adding up the I/O and CPU of each operator in the plan.
+auto parse_estimated_plan(string const & plan)
+{
+    auto const sum = [&plan](string const & name) {
+        auto const values = get_plan_attributes(plan, name);
+        return accumulate(begin(values), end(values), 0.0, [](double acc, string const & value) { return acc + stod(value); });
+    };
+    auto const parallel = get_plan_attributes(plan, "Parallel");
+    auto const is_parallel = any_of(begin(parallel), end(parallel), [](string const & value) { return value == "1" || value == "true"; });
+    return estimated_plan{ sum("StatementSubTreeCost"), sum("EstimateIO"), sum("EstimateCPU"), sum("StatementEstRows"), is_parallel };
+}
+
+// Gets the estimated plan of every search query, without running any of them, one session per database.
+auto get_estimated_plans(search_catalog const & catalog, string_view const to_find, int const concurrency, int const lock_timeout_ms)
+{
+    vector<optional<estimated_plan>> plans(catalog.columns.size());
+    vector<vector<size_t>> columns_by_target(catalog.targets.size());
+    for (size_t i = 0; i != catalog.columns.size(); ++i)
+        columns_by_target[catalog.columns[i].target].push_back(i);
+
+    run_concurrently(catalog.targets.size(), concurrency, [&](size_t const target_index) {
+        auto const & target = catalog.targets[target_index];
+        auto const endpoint = find_if(begin(catalog.endpoints), end(catalog.endpoints), [&target](search_endpoint const & e) { return e.server == target.server; });
+        auto const sql = open_session(endpoint->connection_string, lock_timeout_ms);
+        execute_directly(*sql, "set showplan_xml on");
+        for (auto const column_index : columns_by_target[target_index])
+        {
+            auto const & column = catalog.columns[column_index];
+            trace_span span("plan", "query", active_trace != nullptr ? target.database + "." + column.schema + "." + column.table + "." + column.column : ""s);
+            try
             {
-                fmt::print("    {}\n", value);
+                auto const plan = execute_directly(*sql, build_search_query(target.search_database, column.schema, column.table, column.column, column.locator, to_find, "", false));
+                if (plan.has_value())
+                    plans[column_index] = parse_estimated_plan(plan.value());
+            }
+            catch (soci_error const & e)
+            {
+                write_error("Unable to get the plan for "s + target.database + "." + column.schema + "." + column.table + "." + column.column + ": " + e.what());
             }
-
-            if (match.more_matches_available)
-                write_colour("    ... more available", fmt::color::green);
         }
+    });
+    return plans;
+}
 
-        completed_rows += column.number_of_rows;
-        auto const now = chrono::steady_clock::now();
-        auto const nanoseconds_per_second = 1'000'000'000;
-        write_verbose("Completed "s + to_string(completed_rows) + " rows in " + to_string((now - start_time).count() / nanoseconds_per_second) + " seconds.");
-        if (!matches.empty() || (now - last_displayed).count() / nanoseconds_per_second > 2) {
-            write_progress(total_rows, completed_rows, now - start_time);
-            last_displayed = now;
+// Shows the estimated cost of searching each table, adding up the queries for each of its columns.
+auto display_estimated_plans(search_catalog const & catalog, vector<optional<estimated_plan>> const & plans, bool const qualify_with_server, bool const qualify_with_database)
+{
+    struct table_plan
+    {
+        estimated_plan estimate{};
+        int columns = 0;
+        int parallel_queries = 0;
+    };
+
+    map<string, table_plan> tables;
+    table_plan total;
+    for (size_t i = 0; i != plans.size(); ++i)
+    {
+        if (!plans[i].has_value())
+            continue;
+
+        auto const & column = catalog.columns[i];
+        auto const & target = catalog.targets[column.target];
+        auto const name = (qualify_with_server ? catalog.servers[target.server].name + ":" : ""s) + (qualify_with_database ? target.database + "." : ""s) + column.schema + "." + column.table;
+        for (auto table : { &tables[name], &total })
+        {
+            auto const & plan = plans[i].value();
+            table->estimate.cost += plan.cost;
+            table->estimate.io += plan.io;
+            table->estimate.cpu += plan.cpu;
+            table->estimate.rows += plan.rows;
+            table->parallel_queries += plan.parallel ? 1 : 0;
+            ++table->columns;
         }
     }
+
+    auto const format_line = [](auto const & cost, auto const & io, auto const & cpu, auto const & rows, auto const & parallel, string_view const table) {
+        return fmt::format("{:>12} {:>12} {:>12} {:>14} {:>10}  {}\n", cost, io, cpu, rows, parallel, table);
+    };
+    auto const format_plan = [&format_line](table_plan const & plan, string_view const table) {
+        return format_line(fmt::format("{:.2f}", plan.estimate.cost), fmt::format("{:.2f}", plan.estimate.io), fmt::format("{:.2f}", plan.estimate.cpu), fmt::format("{:.0f}", plan.estimate.rows), fmt::format("{}/{}", plan.parallel_queries, plan.columns), table);
+    };
+    fmt::print("{}", format_line("Cost", "I/O", "CPU", "Matching rows", "Parallel", "Table"));
+    for (auto const & [name, plan] : tables)
+        fmt::print("{}", format_plan(plan, name));
+    fmt::print("{}", format_plan(total, "Total"));
 }
 
-auto find_and_display_matches(string_view to_find, int const maximum_results_per_column, string_view const connection_string)
+
+// Column names and types that usually hold values shaped like the text being searched for.
+struct needle_shape
 {
-    connection_parameters parameters(odbc, string(connection_string));
-    parameters.set_option(odbc_option_driver_complete, to_string(SQL_DRIVER_NOPROMPT));
-    session sql(parameters);
-    sql.set_logger(new database_query_logger);  // `new` is required by SOCI
-    auto const isolation_level_command = get_isolation_level_command(sql);
-    auto all_columns = get_all_string_columns(sql, isolation_level_command);
-    fmt::print("Searching {} columns for '{}'...\n", all_columns.size(), to_find);
+    vector<string> name_hints;
+    vector<string> type_hints;
+};
+
+auto get_needle_shape(string const & to_find)
+{
+    regex const email(R"([^@\s]+@[^@\s]+\.[^@\s]+)");
+    regex const guid(R"(\{?[0-9a-fA-F]{8}-[0-9a-fA-F]{4}-[0-9a-fA-F]{4}-[0-9a-fA-F]{4}-[0-9a-fA-F]{12}\}?)");
+    regex const url(R"((https?://|www\.)\S+)", regex::icase);
+    regex const ip_address(R"(\d{1,3}(\.\d{1,3}){3})");
+    regex const phone_number(R"(\+?[\d\s().-]{7,20})");
+    regex const number(R"(\d+)");
+    if (regex_match(to_find, email))
+        return needle_shape{ { "mail" }, {} };
+    if (regex_match(to_find, guid))
+        return needle_shape{ { "guid", "uuid", "id" }, { "char(36)", "nchar(36)", "varchar(36)", "nvarchar(36)", "char(38)", "nchar(38)", "varchar(38)", "nvarchar(38)" } };
+    if (regex_match(to_find, url))
+        return needle_shape{ { "url", "uri", "link", "href", "web" }, {} };
+    if (regex_match(to_find, ip_address))
+        return needle_shape{ { "ip", "address", "host" }, {} };
+    if (regex_match(to_find, number))
+        return needle_shape{ { "id", "number", "code", "ref" }, {} };
+    if (regex_match(to_find, phone_number))
+        return needle_shape{ { "phone", "tel", "mobile", "fax" }, {} };
+    return needle_shape{};
+}
+
+auto contains_ignoring_case(string_view const text, string_view const part)
+{
+    return find_match_offset(text, part).has_value();
+}
+
+// Ranks columns by how likely they are to hold the text, then by how cheap they are to search, so that
+// the first matches are found as soon as possible.
+auto get_likely_first_priorities(search_catalog const & catalog, string const & to_find, map<string, int> const & previous_matches)
+{
+    auto const shape = get_needle_shape(to_find);
+    auto const total_bytes = accumulate(begin(catalog.columns), end(catalog.columns), 0.0, [](double acc, column_details const & c) { return acc + c.number_of_bytes; });
+    vector<double> priorities;
+    for (auto const & column : catalog.columns)
+    {
+        auto const & target = catalog.targets[column.target];
+        int relevance = 0;
+        auto const previous = previous_matches.find(catalog.servers[target.server].name + '\t' + target.database + '\t' + column.schema + '\t' + column.table + '\t' + column.column);
+        if (previous != previous_matches.end())
+            relevance += 2 * previous->second;
+        if (any_of(begin(shape.name_hints), end(shape.name_hints), [&column](string const & hint) { return contains_ignoring_case(column.column, hint); }))
+            relevance += 2;
+        if (find(begin(shape.type_hints), end(shape.type_hints), column.data_type) != end(shape.type_hints))
+            relevance += 2;
+
+        // A column too short to hold the text cannot match, so it is searched last.
+        if (column.maximum_length > 0 && static_cast<size_t>(column.maximum_length) < to_find.size())
+            relevance = -1;
+
+        // Smaller tables are searched first among columns that are equally likely to match.
+        priorities.push_back(relevance - column.number_of_bytes / (total_bytes + 1));
+    }
+    return priorities;
+}
+
+auto find_and_display_matches(string_view to_find, int const maximum_results_per_column, connection_settings const & connection, vector<search_server> const & servers, string const & database_pattern, snapshot_settings const & snapshot_options, throttle_settings const & throttle, blocking_settings const & blocking, double const hedge_factor, output_settings const & output, catalog_cache * const cache)
+{
+    auto const started_at = chrono::steady_clock::now();
+    auto const initial_concurrency = throttle.adaptive ? throttle.minimum_concurrency : throttle.maximum_concurrency;
+    // Planning must not read any table data, so it makes do with estimated row counts.
+    auto const catalog = discover_search_catalog(connection, servers, database_pattern, snapshot_options, initial_concurrency, blocking.lock_timeout_ms, output.locate_rows, !output.plan_only, cache);
+    auto const & all_columns = catalog.columns;
+    auto const search_many = is_database_pattern(database_pattern);
+    if (output.plan_only)
+    {
+        fmt::print(status_output, "Getting the estimated plans for {} columns...\n", all_columns.size());
+        auto const plans = get_estimated_plans(catalog, to_find, throttle.maximum_concurrency * static_cast<int>(catalog.servers.size()), blocking.lock_timeout_ms);
+        display_estimated_plans(catalog, plans, servers.size() > 1, search_many);
+        return;
+    }
+
+    if (catalog.targets.size() > 1)
+        fmt::print(status_output, "Searching {} columns in {} databases for '{}'...\n", all_columns.size(), catalog.targets.size(), to_find);
+    else
+        fmt::print(status_output, "Searching {} columns for '{}'...\n", all_columns.size(), to_find);
     uint64_t const total_rows = accumulate(begin(all_columns), end(all_columns), 0ULL, [](uint64_t acc, column_details const & b) { return acc + b.number_of_rows; });
-    write_verbose("Total number of rows to search: "s + to_string(total_rows) + ".");
-    display_all_matches(sql, isolation_level_command, all_columns, to_find, maximum_results_per_column, total_rows);
+    uint64_t const total_bytes = accumulate(begin(all_columns), end(all_columns), 0ULL, [](uint64_t acc, column_details const & b) { return acc + b.number_of_bytes; });
+    write_verbose("Total number of rows to search: "s + to_string(total_rows) + " (" + to_string(total_bytes / 1024 / 1024) + " MB of table data).");
+
+    auto costs = output.stats_path.has_value() ? make_unique<cost_model>(output.stats_path.value()) : nullptr;
+    vector<double> predicted_seconds;
+    if (costs)
+    {
+        predicted_seconds.resize(all_columns.size());
+        for (size_t i = 0; i != all_columns.size(); ++i)
+        {
+            auto const & column = all_columns[i];
+            auto const & target = catalog.targets[column.target];
+            auto const key = cost_model::get_key(catalog.servers[target.server].name, target.database, column, get_query_shape(column, false));
+            auto const predicted = costs->predict_seconds(key, column.number_of_bytes);
+            if (!predicted.has_value())
+            {
+                write_verbose("There is no search history yet, so the stats file will only be used to record this run.");
+                predicted_seconds.clear();
+                break;
+            }
+            predicted_seconds[i] = predicted.value();
+        }
+        if (!predicted_seconds.empty())
+            write_verbose(fmt::format("Predicted search time from history: {:.0f} seconds of queries.", accumulate(begin(predicted_seconds), end(predicted_seconds), 0.0)));
+    }
+
+    // The longest searches start first so that none is left running alone at the end, unless there is a
+    // budget, when the cheapest start first so that as many columns as possible are searched within it.
+    auto const budgeted = throttle.time_budget_seconds > 0 || throttle.io_budget_megabytes > 0;
+    vector<double> priorities;
+    if (output.likely_first)
+    {
+        auto const previous_matches = output.results_database_path.has_value() ? get_previous_matches(output.results_database_path.value(), string(to_find)) : map<string, int>();
+        priorities = get_likely_first_priorities(catalog, string(to_find), previous_matches);
+    }
+    else if (budgeted)
+    {
+        for (size_t i = 0; i != all_columns.size(); ++i)
+            priorities.push_back(-(predicted_seconds.empty() ? static_cast<double>(all_columns[i].number_of_bytes) : predicted_seconds[i]));
+    }
+    else
+    {
+        priorities = predicted_seconds;
+    }
+
+    // When streaming every match, a bounded queue keeps memory use constant if output cannot keep up.
+    auto const result_queue_capacity = output.stream_all ? 64 : 0;
+    auto const search_started_at = chrono::steady_clock::now();
+    // The machine-readable formats are UTF-8, which the varchar values used for text output cannot always hold.
+    auto const fetch_utf8 = output.format != output_format::text;
+    search_job job{ catalog.servers, catalog.endpoints, catalog.targets, servers.size() > 1, search_many, all_columns, to_find, fetch_utf8 ? to_utf8(string(to_find)) : string(to_find), fetch_utf8, maximum_results_per_column, output.stream_all, output.report, output.sample_percent, blocking, read_budget(throttle.read_budget_megabytes_per_second),
+        cost_budget(all_columns.size(), throttle.time_budget_seconds, throttle.io_budget_megabytes),
+        work_queue(all_columns, catalog.targets, catalog.endpoints, catalog.servers.size(), initial_concurrency, throttle.maximum_scans_per_data_space, priorities), attempt_registry(all_columns.size()), scan_throughput(), query_metrics(catalog.targets.size()), blocking_queue<search_result>(result_queue_capacity) };
+    search_workers workers(job, throttle.maximum_concurrency * static_cast<int>(catalog.endpoints.size()));
+    vector<unique_ptr<adaptive_throttle>> controllers;
+    if (throttle.adaptive && throttle.minimum_concurrency < throttle.maximum_concurrency)
+    {
+        for (size_t i = 0; i != catalog.endpoints.size(); ++i)
+            controllers.push_back(make_unique<adaptive_throttle>(catalog.endpoints[i].connection_string, job.queue, i, throttle));
+    }
+    optional<straggler_hedger> hedger;
+    if (hedge_factor > 0 && !output.stream_all && catalog.endpoints.size() > catalog.servers.size())
+        hedger.emplace(job, hedge_factor);
+    auto const results = output.results_database_path.has_value() ? make_unique<results_database>(output.results_database_path.value(), job.servers, job.targets, to_find, job.match_text.size(), job.maximum_results_per_column, database_pattern) : nullptr;
+    optional<metrics_exporter> metrics;
+    if (output.prometheus_metrics_path.has_value() || output.json_metrics_path.has_value())
+        metrics.emplace(job, output);
+    auto const report = output.report ? make_unique<run_report>(started_at) : nullptr;
+    display_all_matches(job, output, results.get(), costs.get(), predicted_seconds, report.get());
+    if (report)
+        report->display(job, catalog.timings, search_started_at);
 }
 
 auto get_all_odbc_drivers()
@@ -277,6 +2089,25 @@ auto get_best_sql_server_odbc_driver_name()
     return modern_odbc_driver_name.value_or(native_driver_name.value_or("SQL Server"));
 }
 
+auto read_server_file(string const & path)
+{
+    ifstream file(path);
+    if (!file)
+        throw runtime_error("Unable to read server file " + path + ".");
+
+    vector<string> servers;
+    string line;
+    while (getline(file, line))
+    {
+        auto const first = line.find_first_not_of(" \t\r");
+        if (first == string::npos || line[first] == '#')
+            continue;
+        auto const last = line.find_last_not_of(" \t\r");
+        servers.push_back(line.substr(first, last - first + 1));
+    }
+    return servers;
+}
+
 int main(int argc, char** argv)
 {
     set_up_console();
@@ -286,23 +2117,74 @@ int main(int argc, char** argv)
     formatter->column_width(50);
     app.formatter(formatter);
     string database;
-    app.add_option("database", database, "The database to search")->mandatory();
+    app.add_option("database", database, "The database to search, which may contain * and ? wildcards to search many databases")->mandatory();
     string search_string;
     app.add_option("search-string", search_string, "The text to search for")->mandatory();
     bool verbose = false;
     app.add_flag("-v,--verbose", verbose, "Verbose mode");
     int maximum_results_per_column;
     app.add_option("-m,--max-results", maximum_results_per_column, "Maxmium number of matches to return per column")->default_val(5);
-    string server;
-    app.add_option("-s,--server", server, "The SQL server that has the database to search")->default_val("localhost");
+    vector<string> servers;
+    app.add_option("-s,--server", servers, "The SQL server that has the database to search, which may be repeated to search many servers (default: localhost)");
+    optional<string> server_file;
+    app.add_option("--server-file", server_file, "A file listing SQL servers to search, one per line")->check(CLI::ExistingFile);
+    vector<string> replicas;
+    app.add_option("--replica", replicas, "A readable secondary replica to search instead of the server, which may be repeated to spread the search across replicas");
+    double hedge_factor;
+    app.add_option("--hedge-after", hedge_factor, "Start a second copy of a search on another replica once it has run this many times longer than expected (0 disables)")->default_val(0)->check(CLI::NonNegativeNumber);
+    bool read_only_intent = false;
+    app.add_flag("--read-only-intent", read_only_intent, "Connect with ApplicationIntent=ReadOnly so that availability group listeners route to readable secondaries");
     optional<string> username;
     auto user_name_option = app.add_option("-u,--user-name", username, "The name of the user to connect as");
     optional<string> password;
     auto password_option = app.add_option("-p,--password", password, "The password of the user to connect as");
     user_name_option->needs(password_option);
     password_option->needs(user_name_option);
-    string driver;
-    app.add_option("-d,--driver", driver, "The ODBC database driver to use")->default_val(get_best_sql_server_odbc_driver_name());
+    optional<string> driver;
+    app.add_option("-d,--driver", driver, "The ODBC database driver to use (default: the newest SQL Server driver installed)");
+    throttle_settings throttle{};
+    app.add_option("-j,--concurrency", throttle.maximum_concurrency, "Maximum number of search queries to run at the same time on each server")->default_val(1)->check(CLI::PositiveNumber);
+    app.add_option("--min-concurrency", throttle.minimum_concurrency, "Minimum number of concurrent search queries when adapting to server load")->default_val(1)->check(CLI::PositiveNumber);
+    app.add_flag("--adaptive", throttle.adaptive, "Grow and shrink the number of concurrent queries based on live server load");
+    app.add_option("--read-budget", throttle.read_budget_megabytes_per_second, "Maximum MB/s of table data to scan (0 for unlimited)")->default_val(0)->check(CLI::NonNegativeNumber);
+    app.add_option("--time-budget", throttle.time_budget_seconds, "Stop starting searches after this many seconds, searching the cheapest tables first, and report which were not searched (0 for unlimited)")->default_val(0)->check(CLI::NonNegativeNumber);
+    app.add_option("--io-budget", throttle.io_budget_megabytes, "Maximum MB of table data to scan in total, searching the cheapest tables first, and report which were not searched (0 for unlimited)")->default_val(0)->check(CLI::NonNegativeNumber);
+    app.add_option("--max-scans-per-volume", throttle.maximum_scans_per_data_space, "Maximum number of concurrent scans of tables on the same volume, or filegroup if volumes cannot be seen (0 for unlimited)")->default_val(0)->check(CLI::NonNegativeNumber);
+    snapshot_settings snapshot_options{};
+    app.add_flag("--snapshot", snapshot_options.enabled, "Search a temporary database snapshot so that all queries see the same point in time");
+    app.add_option("--snapshot-name", snapshot_options.name, "The database snapshot to search, which is created and dropped again if it does not exist");
+    blocking_settings blocking{};
+    output_settings output{ true, 256, output_format::text, {}, false, false, false, false, false, 0, {}, {}, {}, 0 };
+    map<string, output_format> const formats{ { "text", output_format::text }, { "jsonl", output_format::jsonl }, { "csv", output_format::csv }, { "arrow", output_format::arrow } };
+    app.add_option("--format", output.format, "How to write matches: text, jsonl (JSON Lines), csv or arrow (Arrow IPC stream)")->transform(CLI::CheckedTransformer(formats, CLI::ignore_case))->default_val("text");
+    app.add_flag("!--unordered", output.ordered, "Display matches as soon as each column is searched instead of in catalog order");
+    app.add_option("--reorder-memory", output.reorder_memory_megabytes, "Maximum MB of matches to hold back while waiting to display them in catalog order")->default_val(256)->check(CLI::PositiveNumber);
+
+    app.add_flag("--all", output.stream_all, "Output every match, fetched and written in batches as the search runs (implies --unordered and no --hedge-after)");
+    optional<string> catalog_cache_path;
+    app.add_option("--catalog-cache", catalog_cache_path, "A file to keep each database's string columns and table sizes in between runs, reused until its schema changes, along with the ODBC driver chosen");
+    app.add_option("--stats-file", output.stats_path, "A file of search times from earlier runs, used to start the slowest tables first and estimate the time remaining, and updated after each run");
+    app.add_option("--metrics-prometheus", output.prometheus_metrics_path, "A file to write query timings, rows and bytes to in the Prometheus text format, such as for node exporter's textfile collector");
+    app.add_option("--metrics-json", output.json_metrics_path, "A file to write query timings, rows and bytes to as JSON");
+    app.add_option("--metrics-interval", output.metrics_interval_seconds, "How often, in seconds, to update the metrics files while searching, or 0 to write them only at the end")->default_val(0)->check(CLI::NonNegativeNumber);
+    optional<string> trace_path;
+    app.add_flag("--likely-first", output.likely_first, "Search the columns most likely to hold the text first: small tables, columns whose name or type suits the text, and columns that matched before in the --output-db database, showing matches as they are found");
+    // Sampling 100 percent would search every page while still counting and estimating matches.
+    auto const sample_percentage = CLI::Validator([](string & value) {
+        double percent;
+        return CLI::detail::lexical_cast(value, percent) && percent >= 0 && percent < 100 ? ""s : "Value " + value + " not in range [0 - 100)";
+    }, "in [0 - 100)");
+    app.add_option("--sample", output.sample_percent, "Search only this percentage of the pages of each table with more than 10000 rows, for a quick answer, and estimate how many rows of each column match")->check(sample_percentage);
+    app.add_flag("--plan", output.plan_only, "Show the estimated cost of searching each table, from the server's query plans, without searching any of them");
+    app.add_flag("--report", output.report, "Show where the time went and which tables were the most expensive to search when the search finishes");
+    app.add_option("--trace", trace_path, "A file to write a timeline of the search to as Chrome trace events, for viewing in Perfetto or chrome://tracing");
+    app.add_flag("--locate", output.locate_rows, "Show the primary key (or unique key, or physical location) of each matching row");
+    app.add_option("--output-db", output.results_database_path, "A SQLite database to record matches and per-column statistics in, which is created if it does not exist");
+
+    app.add_option("--lock-timeout", blocking.lock_timeout_ms, "Milliseconds to wait for a locked table before deferring it (-1 waits indefinitely)")->default_val(-1)->check(CLI::Range(-1, numeric_limits<int>::max()));
+    app.add_option("--max-deferrals", blocking.maximum_deferrals, "Number of times a locked table is deferred before giving up on it")->default_val(3)->check(CLI::NonNegativeNumber);
+    map<string, blocked_table_fallback> const fallbacks{ { "none", blocked_table_fallback::none }, { "readpast", blocked_table_fallback::readpast }, { "read-uncommitted", blocked_table_fallback::read_uncommitted } };
+    app.add_option("--blocked-fallback", blocking.fallback, "How to search tables that stay locked: none, readpast (skip locked rows) or read-uncommitted (read uncommitted rows)")->transform(CLI::CheckedTransformer(fallbacks, CLI::ignore_case))->default_val("none");
 
     try
     {
@@ -316,13 +2198,64 @@ int main(int argc, char** argv)
     auto const credential = password.has_value()
         ? "Uid=" + username.value() + ";Pwd=" + password.value()
         : "Trusted_Connection=Yes";
-    auto const connection_string = "Driver={" + driver + "};Server=" + server + ";Database=" + database + ";Encrypt=Optional;App=sqlgrep;" + credential;
+    snapshot_options.enabled = snapshot_options.enabled || snapshot_options.name.has_value();
     verbose_messages_enabled = verbose;
+    if (output.format != output_format::text)
+        status_output = stderr;
+    status_is_terminal = is_terminal(status_output);
+    if (output.likely_first)
+        output.ordered = false;
+    if (output.stream_all)
+    {
+        output.ordered = false;
+        maximum_results_per_column = numeric_limits<int>::max();
+    }
+    if (output.format == output_format::arrow)
+        set_binary_mode(stdout);
+    throttle.minimum_concurrency = min(throttle.minimum_concurrency, throttle.maximum_concurrency);
 
     try
     {
-        find_and_display_matches(search_string, maximum_results_per_column, connection_string);
-        fmt::print("{}\n", clear_eol);
+        optional<trace_log> trace;
+        if (trace_path.has_value())
+        {
+            trace.emplace(trace_path.value());
+            active_trace = &trace.value();
+            name_trace_thread("main");
+        }
+        if (server_file.has_value())
+        {
+            auto const listed_servers = read_server_file(server_file.value());
+            servers.insert(end(servers), begin(listed_servers), end(listed_servers));
+        }
+        if (servers.empty())
+            servers.push_back("localhost");
+        if (!replicas.empty() && servers.size() > 1)
+            throw runtime_error("Replicas can only be given when searching a single server.");
+        if (replicas.size() > 1 && snapshot_options.enabled)
+            throw runtime_error("A snapshot exists only on the replica it was created on, so it cannot be searched across several replicas.");
+
+        vector<search_server> search_servers;
+        for (auto const & server : servers)
+            search_servers.push_back({ server, replicas.empty() ? vector<string>{ server } : replicas });
+
+        // Looking through the installed drivers is left until a search needs one, so that --help stays quick.
+        optional<catalog_cache> cache;
+        if (catalog_cache_path.has_value())
+            cache.emplace(catalog_cache_path.value());
+        if (!driver.has_value() && cache.has_value())
+            driver = cache->get_driver();
+        if (!driver.has_value())
+        {
+            driver = get_best_sql_server_odbc_driver_name();
+            if (cache.has_value())
+                cache->set_driver(driver.value());
+        }
+        connection_settings const connection{ driver.value(), credential, read_only_intent };
+
+        find_and_display_matches(search_string, maximum_results_per_column, connection, search_servers, database, snapshot_options, throttle, blocking, hedge_factor, output, cache.has_value() ? &cache.value() : nullptr);
+        if (status_is_terminal)
+            fmt::print(status_output, "{}\n", clear_eol);
         return 0;
     }
     catch (odbc_soci_error & e)
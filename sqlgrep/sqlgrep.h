@@ -1,2 +1,6 @@
 void set_up_console();
 void on_driver_not_found();
+bool is_terminal(FILE * stream);
+void set_binary_mode(FILE * stream);
+std::string to_utf8(std::string const & text);
+bool replace_with(std::string const & from, std::string const & to);
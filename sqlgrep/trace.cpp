@@ -0,0 +1,90 @@
+#include "pch.h"
+#include "trace.h"
+#include "file_formats.h"
+#include "messages.h"
+
+using namespace std;
+
+trace_log * active_trace = nullptr;
+
+trace_log::trace_log(string path) : path_(move(path)), started_at_(chrono::steady_clock::now())
+{
+}
+
+trace_log::~trace_log()
+{
+    try
+    {
+        string contents = "{\"traceEvents\":[\n";
+        for (auto const & [thread_id, name] : thread_names_)
+            contents += fmt::format("{{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":{},\"args\":{{\"name\":{}}}}},\n", thread_id, escape_json_string(name));
+        for (auto const & event : events_)
+            contents += event + ",\n";
+        contents += "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"tid\":0,\"args\":{\"name\":\"sqlgrep\"}}\n]}\n";
+        replace_file(path_, contents);
+    }
+    catch (exception const & e)
+    {
+        write_error("Unable to write the trace: "s + e.what());
+    }
+}
+
+void trace_log::add_span(string_view const name, string_view const category, chrono::steady_clock::time_point const started_at, string_view const detail)
+{
+    auto const ended_at = chrono::steady_clock::now();
+    auto event = fmt::format("{{\"name\":{},\"cat\":\"{}\",\"ph\":\"X\",\"pid\":1,\"tid\":{},\"ts\":{},\"dur\":{}", escape_json_string(name), category, get_thread_id(), get_microseconds(started_at), get_microseconds(ended_at) - get_microseconds(started_at));
+    add_event(move(event), detail);
+}
+
+void trace_log::add_instant(string_view const name, string_view const category, string_view const detail)
+{
+    auto event = fmt::format("{{\"name\":{},\"cat\":\"{}\",\"ph\":\"i\",\"s\":\"t\",\"pid\":1,\"tid\":{},\"ts\":{}", escape_json_string(name), category, get_thread_id(), get_microseconds(chrono::steady_clock::now()));
+    add_event(move(event), detail);
+}
+
+void trace_log::name_thread(string name)
+{
+    auto const thread_id = get_thread_id();
+    lock_guard<mutex> lock(mutex_);
+    thread_names_[thread_id] = move(name);
+}
+
+int64_t trace_log::get_microseconds(chrono::steady_clock::time_point const time) const
+{
+    return chrono::duration_cast<chrono::microseconds>(time - started_at_).count();
+}
+
+// Numbers threads in the order they are first seen, which keeps the lanes in a sensible order. Thread
+// IDs are not used because they can be reused once a thread has finished.
+int trace_log::get_thread_id()
+{
+    thread_local int thread_id = 0;
+    if (thread_id == 0)
+    {
+        lock_guard<mutex> lock(mutex_);
+        thread_id = ++number_of_threads_;
+        thread_names_.emplace(thread_id, "thread " + to_string(thread_id));
+    }
+    return thread_id;
+}
+
+void trace_log::add_event(string event, string_view const detail)
+{
+    if (!detail.empty())
+        event += ",\"args\":{\"detail\":" + escape_json_string(detail) + "}";
+    event += '}';
+    lock_guard<mutex> lock(mutex_);
+    events_.push_back(move(event));
+}
+
+void trace_instant(string_view const name, string_view const category, string_view const detail)
+{
+    if (active_trace != nullptr)
+        active_trace->add_instant(name, category, detail);
+}
+
+void name_trace_thread(string name)
+{
+    if (active_trace != nullptr)
+        active_trace->name_thread(move(name));
+}
@@ -0,0 +1,69 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+// Records what each thread is doing as Chrome trace events, which Perfetto and chrome://tracing show as
+// a timeline with a lane for each thread. Events are kept in memory and written when the run ends.
+class trace_log
+{
+public:
+    explicit trace_log(std::string path);
+    ~trace_log();
+
+    trace_log(trace_log const &) = delete;
+    trace_log & operator=(trace_log const &) = delete;
+
+    void add_span(std::string_view name, std::string_view category, std::chrono::steady_clock::time_point started_at, std::string_view detail);
+    void add_instant(std::string_view name, std::string_view category, std::string_view detail);
+    void name_thread(std::string name);
+
+private:
+    int64_t get_microseconds(std::chrono::steady_clock::time_point time) const;
+    int get_thread_id();
+    void add_event(std::string event, std::string_view detail);
+
+    std::string const path_;
+    std::chrono::steady_clock::time_point const started_at_;
+    std::mutex mutex_;
+    int number_of_threads_ = 0;
+    std::map<int, std::string> thread_names_;
+    std::vector<std::string> events_;
+};
+
+// Null unless --trace is given, so that tracing costs no more than a check when disabled.
+extern trace_log * active_trace;
+
+// Records the time from its construction to its destruction as a trace event. A detail that takes work to
+// build should only be built when active_trace is set, since it is built before the span can check.
+class trace_span
+{
+public:
+    trace_span(std::string_view const name, std::string_view const category, std::string detail = {})
+        : name_(name), category_(category)
+    {
+        if (active_trace != nullptr)
+        {
+            started_at_ = std::chrono::steady_clock::now();
+            detail_ = std::move(detail);
+        }
+    }
+
+    ~trace_span()
+    {
+        if (active_trace != nullptr)
+            active_trace->add_span(name_, category_, started_at_, detail_);
+    }
+
+    trace_span(trace_span const &) = delete;
+    trace_span & operator=(trace_span const &) = delete;
+
+private:
+    std::string_view const name_;
+    std::string_view const category_;
+    std::chrono::steady_clock::time_point started_at_;
+    std::string detail_;
+};
+
+void trace_instant(std::string_view name, std::string_view category, std::string_view detail = {});
+void name_trace_thread(std::string name);
+
+#endif //TRACE_H
@@ -1,4 +1,6 @@
 #include "pch.h"
+#include <fcntl.h>
+#include <io.h>
 
 void set_up_console()
 {
@@ -11,3 +13,34 @@ void set_up_console()
 void on_driver_not_found()
 {
 }
+
+bool is_terminal(FILE * stream)
+{
+    return _isatty(_fileno(stream)) != 0;
+}
+
+void set_binary_mode(FILE * stream)
+{
+    _setmode(_fileno(stream), _O_BINARY);
+}
+
+// rename fails if the destination exists, so the file is moved over it instead.
+bool replace_with(std::string const & from, std::string const & to)
+{
+    return MoveFileExA(from.c_str(), to.c_str(), MOVEFILE_REPLACE_EXISTING) != 0;
+}
+
+// Command line arguments are in the ANSI code page.
+std::string to_utf8(std::string const & text)
+{
+    if (text.empty())
+        return text;
+
+    auto const wide_length = MultiByteToWideChar(CP_ACP, 0, text.data(), static_cast<int>(text.size()), nullptr, 0);
+    std::wstring wide(wide_length, L'\0');
+    MultiByteToWideChar(CP_ACP, 0, text.data(), static_cast<int>(text.size()), wide.data(), wide_length);
+    auto const utf8_length = WideCharToMultiByte(CP_UTF8, 0, wide.data(), wide_length, nullptr, 0, nullptr, nullptr);
+    std::string utf8(utf8_length, '\0');
+    WideCharToMultiByte(CP_UTF8, 0, wide.data(), wide_length, utf8.data(), utf8_length, nullptr, nullptr);
+    return utf8;
+}
@@ -0,0 +1,256 @@
+#include "pch.h"
+#include "search_types.h"
+#include "work_queue.h"
+#include "file_formats.h"
+
+using namespace std;
+
+work_queue::work_queue(vector<column_details> const & columns, vector<search_target> const & targets, vector<search_endpoint> const & endpoints, size_t const number_of_servers, int const initial_concurrency, int const maximum_scans_per_data_space, vector<double> const & priorities)
+    : columns_(columns), targets_(targets), priorities_(priorities), servers_(number_of_servers), endpoints_(endpoints.size()), maximum_scans_per_data_space_(maximum_scans_per_data_space)
+{
+    for (size_t i = 0; i != endpoints.size(); ++i)
+    {
+        servers_[endpoints[i].server].endpoints.push_back(i);
+        endpoints_[i].server = endpoints[i].server;
+        endpoints_[i].limit = initial_concurrency;
+    }
+    for (size_t i = 0; i != columns.size(); ++i)
+    {
+        auto& server = servers_[get_server(i)];
+        server.items[columns[i].data_space].push_back({ i, 0, {}, 0 });
+        ++server.queued;
+    }
+
+    // Columns with a higher priority are searched first within each data space, and take_item compares
+    // the next column of each data space so that the order also holds across data spaces.
+    if (!priorities.empty())
+    {
+        for (auto& server : servers_)
+        {
+            for (auto& [data_space, items] : server.items)
+                stable_sort(begin(items), end(items), [&](work_item const & a, work_item const & b) { return priorities[a.column_index] > priorities[b.column_index]; });
+        }
+    }
+}
+
+optional<work_item> work_queue::pop()
+{
+    unique_lock<mutex> lock(mutex_);
+    while (!stopping_)
+    {
+        auto const now = chrono::steady_clock::now();
+        optional<chrono::steady_clock::time_point> earliest;
+        bool any_remaining = false;
+        for (size_t i = 0; i != servers_.size(); ++i)
+        {
+            auto const server_index = (next_server_ + i) % servers_.size();
+            auto& server = servers_[server_index];
+            any_remaining = any_remaining || server.queued > 0 || any_of(begin(server.endpoints), end(server.endpoints), [this](size_t e) { return endpoints_[e].active > 0; });
+            auto ready = take_hedge(server);
+            if (!ready.has_value())
+                ready = take_item(server, now, earliest);
+            if (ready.has_value())
+            {
+                ++endpoints_[ready->endpoint].active;
+                ++scans_[{ ready->endpoint, columns_[ready->column_index].data_space }];
+                next_server_ = server_index + 1;
+                return ready;
+            }
+        }
+
+        if (!any_remaining)
+            break;
+        if (earliest.has_value())
+            changed_.wait_until(lock, earliest.value());
+        else
+            changed_.wait(lock);
+    }
+    return {};
+}
+
+void work_queue::complete(work_item const & item)
+{
+    {
+        lock_guard<mutex> lock(mutex_);
+        release(item);
+    }
+    changed_.notify_all();
+}
+
+void work_queue::defer(work_item item, chrono::steady_clock::duration const retry_delay)
+{
+    {
+        lock_guard<mutex> lock(mutex_);
+        auto const & column = columns_[item.column_index];
+        blocked_until_[get_blocking_key(column)] = chrono::steady_clock::now() + retry_delay;
+        release(item);
+        auto& server = servers_[get_server(item.column_index)];
+        server.items[column.data_space].push_back(move(item));
+        ++server.queued;
+    }
+    changed_.notify_all();
+}
+
+void work_queue::hedge(work_item item)
+{
+    {
+        lock_guard<mutex> lock(mutex_);
+        auto& server = servers_[get_server(item.column_index)];
+        if (server.endpoints.size() < 2)
+            return;
+        server.hedges.push_back(move(item));
+    }
+    changed_.notify_all();
+}
+
+void work_queue::set_limit(size_t const endpoint, int const limit)
+{
+    {
+        lock_guard<mutex> lock(mutex_);
+        endpoints_[endpoint].limit = limit;
+    }
+    changed_.notify_all();
+}
+
+int work_queue::get_limit(size_t const endpoint)
+{
+    lock_guard<mutex> lock(mutex_);
+    return endpoints_[endpoint].limit;
+}
+
+int work_queue::get_active(size_t const endpoint)
+{
+    lock_guard<mutex> lock(mutex_);
+    return endpoints_[endpoint].active;
+}
+
+bool work_queue::has_work(size_t const endpoint)
+{
+    lock_guard<mutex> lock(mutex_);
+    auto const & server = servers_[endpoints_[endpoint].server];
+    return server.queued > 0 || !server.hedges.empty();
+}
+
+void work_queue::stop()
+{
+    {
+        lock_guard<mutex> lock(mutex_);
+        stopping_ = true;
+    }
+    changed_.notify_all();
+}
+
+void work_queue::release(work_item const & item)
+{
+    --endpoints_[item.endpoint].active;
+    --scans_[{ item.endpoint, columns_[item.column_index].data_space }];
+}
+
+bool work_queue::has_scan_capacity(size_t const endpoint, string const & data_space) const
+{
+    if (maximum_scans_per_data_space_ <= 0)
+        return true;
+    auto const scans = scans_.find({ endpoint, data_space });
+    return scans == scans_.end() || scans->second < maximum_scans_per_data_space_;
+}
+
+int work_queue::get_scans(size_t const endpoint, string const & data_space) const
+{
+    auto const scans = scans_.find({ endpoint, data_space });
+    return scans == scans_.end() ? 0 : scans->second;
+}
+
+optional<work_item> work_queue::take_hedge(server_queue & server)
+{
+    for (auto hedge = begin(server.hedges); hedge != end(server.hedges); ++hedge)
+    {
+        auto const endpoint = choose_endpoint(server, hedge->endpoint);
+        if (endpoint.has_value() && has_scan_capacity(endpoint.value(), columns_[hedge->column_index].data_space))
+        {
+            auto ready = move(*hedge);
+            server.hedges.erase(hedge);
+            ready.endpoint = endpoint.value();
+            return ready;
+        }
+    }
+    return {};
+}
+
+optional<work_item> work_queue::take_item(server_queue & server, chrono::steady_clock::time_point const now, optional<chrono::steady_clock::time_point> & earliest)
+{
+    auto const endpoint = choose_endpoint(server, {});
+    if (!endpoint.has_value())
+        return {};
+
+    deque<work_item> * chosen_items = nullptr;
+    deque<work_item>::iterator chosen;
+    int chosen_scans = 0;
+    for (auto& [data_space, items] : server.items)
+    {
+        auto const scans = get_scans(endpoint.value(), data_space);
+        if (!has_scan_capacity(endpoint.value(), data_space) || (chosen_items != nullptr && scans > chosen_scans))
+            continue;
+
+        for (auto item = begin(items); item != end(items); ++item)
+        {
+            auto const ready_at = get_ready_time(*item);
+            if (ready_at <= now)
+            {
+                // Of the data spaces with the fewest scans, the one whose next column has the highest priority goes first.
+                if (chosen_items == nullptr || scans < chosen_scans || get_priority(*item) > get_priority(*chosen))
+                {
+                    chosen_items = &items;
+                    chosen = item;
+                    chosen_scans = scans;
+                }
+                break;
+            }
+            if (!earliest.has_value() || ready_at < earliest.value())
+                earliest = ready_at;
+        }
+    }
+
+    if (chosen_items == nullptr)
+        return {};
+    auto ready = move(*chosen);
+    chosen_items->erase(chosen);
+    --server.queued;
+    ready.endpoint = endpoint.value();
+    return ready;
+}
+
+optional<size_t> work_queue::choose_endpoint(server_queue const & server, optional<size_t> const excluded) const
+{
+    optional<size_t> chosen;
+    for (auto const endpoint : server.endpoints)
+    {
+        auto const & load = endpoints_[endpoint];
+        if (load.active >= load.limit || endpoint == excluded)
+            continue;
+        if (!chosen.has_value() || load.active * endpoints_[chosen.value()].limit < endpoints_[chosen.value()].active * load.limit)
+            chosen = endpoint;
+    }
+    return chosen;
+}
+
+size_t work_queue::get_server(size_t const column_index) const
+{
+    return targets_[columns_[column_index].target].server;
+}
+
+double work_queue::get_priority(work_item const & item) const
+{
+    return priorities_.empty() ? 0 : priorities_[item.column_index];
+}
+
+chrono::steady_clock::time_point work_queue::get_ready_time(work_item const & item) const
+{
+    auto const & column = columns_[item.column_index];
+    auto const blocked = blocked_until_.find(get_blocking_key(column));
+    return blocked == blocked_until_.end() ? chrono::steady_clock::time_point() : blocked->second;
+}
+
+string work_queue::get_blocking_key(column_details const & column)
+{
+    return to_string(column.target) + "\t" + escape_field(column.schema) + "\t" + escape_field(column.table);
+}
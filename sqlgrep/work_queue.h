@@ -0,0 +1,80 @@
+#ifndef WORK_QUEUE_H
+#define WORK_QUEUE_H
+
+struct work_item
+{
+    size_t column_index;
+    int deferrals;
+    std::string blocked_reason;
+    size_t endpoint;
+};
+
+// Hands out columns to search, taking turns between servers. Each column is sent to the least busy
+// endpoint (such as a readable secondary replica) of its server that has not reached its limit of
+// concurrent queries. Within a server, columns are taken from the volume or filegroup with the fewest
+// scans running, optionally capped, so that scans are spread across disks. Columns whose table was
+// blocked are moved to the back and are not handed out again until the table has had time to be released.
+class work_queue
+{
+public:
+    work_queue(std::vector<column_details> const & columns, std::vector<search_target> const & targets, std::vector<search_endpoint> const & endpoints,
+        size_t number_of_servers, int initial_concurrency, int maximum_scans_per_data_space, std::vector<double> const & priorities);
+
+    std::optional<work_item> pop();
+    void complete(work_item const & item);
+    void defer(work_item item, std::chrono::steady_clock::duration retry_delay);
+
+    // Queues another attempt at a column that is already being searched, to run on a different endpoint.
+    void hedge(work_item item);
+
+    void set_limit(size_t endpoint, int limit);
+    int get_limit(size_t endpoint);
+    int get_active(size_t endpoint);
+
+    // Returns whether the endpoint's server still has columns waiting to be searched.
+    bool has_work(size_t endpoint);
+
+    void stop();
+
+private:
+    struct server_queue
+    {
+        std::map<std::string, std::deque<work_item>> items;
+        size_t queued = 0;
+        std::deque<work_item> hedges;
+        std::vector<size_t> endpoints;
+    };
+
+    struct endpoint_load
+    {
+        size_t server = 0;
+        int limit = 0;
+        int active = 0;
+    };
+
+    void release(work_item const & item);
+    bool has_scan_capacity(size_t endpoint, std::string const & data_space) const;
+    int get_scans(size_t endpoint, std::string const & data_space) const;
+    std::optional<work_item> take_hedge(server_queue & server);
+    std::optional<work_item> take_item(server_queue & server, std::chrono::steady_clock::time_point now, std::optional<std::chrono::steady_clock::time_point> & earliest);
+    std::optional<size_t> choose_endpoint(server_queue const & server, std::optional<size_t> excluded) const;
+    size_t get_server(size_t column_index) const;
+    double get_priority(work_item const & item) const;
+    std::chrono::steady_clock::time_point get_ready_time(work_item const & item) const;
+    static std::string get_blocking_key(column_details const & column);
+
+    std::vector<column_details> const & columns_;
+    std::vector<search_target> const & targets_;
+    std::vector<double> const priorities_;
+    std::mutex mutex_;
+    std::condition_variable changed_;
+    std::vector<server_queue> servers_;
+    std::vector<endpoint_load> endpoints_;
+    std::map<std::pair<size_t, std::string>, int> scans_;
+    int const maximum_scans_per_data_space_;
+    size_t next_server_ = 0;
+    std::unordered_map<std::string, std::chrono::steady_clock::time_point> blocked_until_;
+    bool stopping_ = false;
+};
+
+#endif //WORK_QUEUE_H